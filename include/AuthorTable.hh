@@ -0,0 +1,40 @@
+
+#ifndef GITSTOCKAUTHORTABLE_HH
+#define GITSTOCKAUTHORTABLE_HH
+
+#include <string>
+#include <stdint.h>
+
+namespace gitstock {
+
+class AuthorTableImpl;
+
+//
+// Process wide table of author identities. Signatures are resolved through the
+// mailmap and each distinct resolved email is assigned a dense id the first
+// time it is seen; the name is the first resolved name for that email. Ids are
+// never reused and the strings behind an id never change, so they can be read
+// without locking.
+//
+class AuthorTable {
+public:
+    static const uint32_t NO_AUTHOR = 0xffffffff;
+
+    static AuthorTable& get();
+
+    uint32_t intern(const std::string& email, const std::string& name);
+
+    const std::string& email(uint32_t id) const;
+    const std::string& name(uint32_t id) const;
+    uint32_t count() const;
+
+private:
+    AuthorTable();
+    ~AuthorTable();
+
+    AuthorTableImpl *pImpl;
+};
+
+}
+
+#endif
@@ -0,0 +1,52 @@
+
+#ifndef GITSTOCKBLAMECACHE_HH
+#define GITSTOCKBLAMECACHE_HH
+
+#include <string>
+#include <functional>
+#include <stddef.h>
+#include <git2/oid.h>
+
+namespace gitstock {
+
+class FileMetrics;
+class BlameCacheImpl;
+
+//
+// Cache of blame results for history mode. The same blob doesn't mean the
+// same blame, e.g. after a revert or when a file is deleted and added again,
+// so each result is kept with the range of snapshots it is known to be valid
+// for. A snapshot outside the range only gets a copy if the path didn't
+// change in any snapshot in between, and the range then grows to include it.
+// Only a few versions of each path are kept, which is enough for the days
+// currently being processed by the worker threads.
+//
+class BlameCache {
+public:
+    // whether a path has the same history in a snapshot as in the one before
+    // it, given the snapshot's sequence
+    typedef std::function<bool(size_t, const std::string&)> Unchanged;
+
+    BlameCache(const Unchanged& unchanged, int versionsPerPath = 2);
+    ~BlameCache();
+
+    // Returns true if a result for path is valid in snapshot sequence.
+    // metrics is set to a new copy of it, or nullptr if the blob is not a
+    // text file.
+    bool find(size_t sequence, const std::string& path, const git_oid *blob,
+              FileMetrics **metrics);
+    void insert(size_t sequence, const std::string& path, const git_oid *blob,
+                const FileMetrics *metrics);
+    // drop every cached result, used to give memory back under pressure
+    void clear();
+
+    int hits() const;
+    int misses() const;
+
+private:
+    BlameCacheImpl *pImpl;
+};
+
+}
+
+#endif
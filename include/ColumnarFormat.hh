@@ -0,0 +1,148 @@
+
+#ifndef GITSTOCKCOLUMNARFORMAT_HH
+#define GITSTOCKCOLUMNARFORMAT_HH
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+//
+// Layout of columnar history output, shared by ColumnarWriter and
+// ColumnarReader. All integers are little endian and every structure and
+// column starts on an 8 byte boundary, so a reader can use the columns of a
+// memory mapped file in place.
+//
+// The file starts with a ColumnarFileHeader and is followed by chunks, each
+// a ColumnarChunkHeader and its payload. Dictionary chunks define strings
+// (file paths, author emails and names) by id; ids are dense, start at 0
+// and are defined in order, always before the first chunk that uses them.
+// Every other chunk is a partition with the tables of one history day: a
+// day partition holds the commit-day and commit tables and a snapshot
+// partition the tree, file, stock-file and stock tables. A partition starts
+// with a ColumnarPartitionHeader and a directory of ColumnarColumnEntry, one
+// for each column it has, pointing at the column data.
+//
+// Tables and columns correspond to the "_type"s and keys of the JSON
+// records, except that a stock-file row refers to its row in the file
+// table instead of repeating the path.
+//
+namespace columnar {
+
+const char FILE_MAGIC[8] = { 'G', 'S', 'T', 'O', 'C', 'K', 'C', '1' };
+const uint32_t FORMAT_VERSION = 1;
+
+// dictionary id of a missing string, such as a commit without a committer
+const uint32_t NO_STRING = 0xffffffff;
+
+enum ChunkType {
+    CHUNK_DICTIONARY = 1,
+    CHUNK_DAY = 2,
+    CHUNK_SNAPSHOT = 3
+};
+
+enum Table {
+    TABLE_COMMIT_DAY,
+    TABLE_COMMIT,
+    TABLE_TREE,
+    TABLE_FILE,
+    TABLE_STOCK_FILE,
+    TABLE_STOCK,
+    TABLE_COUNT
+};
+
+enum Column {
+    COLUMN_TIMESTAMP,
+    COLUMN_COMMIT_COUNT,
+    COLUMN_COMMIT_SPAN_HOURS,
+    COLUMN_TOTAL_COMMIT_COUNT,
+    COLUMN_AUTHOR_EMAIL,
+    COLUMN_AUTHOR_NAME,
+    COLUMN_DAY_OF_THE_WEEK,
+    COLUMN_HOUR_OF_THE_DAY,
+    COLUMN_MESSAGE,
+    COLUMN_FILE_COUNT,
+    COLUMN_FILE_PATH,
+    // row of a stock-file's file in the file table
+    COLUMN_FILE,
+    COLUMN_FIRST_COMMIT_TIMESTAMP,
+    COLUMN_LAST_COMMIT_TIMESTAMP,
+    COLUMN_LINE_AGE_MEAN,
+    COLUMN_LINE_AGE_MEDIAN,
+    COLUMN_LINE_AGE_P90,
+    COLUMN_LINE_AGE_STANDARD_DEVIATION,
+    COLUMN_LINE_AGE_VARIANCE,
+    COLUMN_LINE_COUNT,
+    COLUMN_OWNERSHIP,
+    COLUMN_COUNT
+};
+
+enum Encoding {
+    ENCODING_INT64 = 1,
+    ENCODING_UINT64 = 2,
+    ENCODING_DOUBLE = 3,
+    // uint32 offsets from the column's base, for timestamps
+    ENCODING_DELTA32 = 4,
+    // uint32 dictionary ids
+    ENCODING_STRING_ID = 5,
+    ENCODING_UINT8 = 6,
+    // rows + 1 uint32 offsets into the bytes that follow them
+    ENCODING_TEXT = 7,
+    // uint32 row numbers
+    ENCODING_ROW = 8
+};
+
+struct ColumnarFileHeader {
+    char magic[8];
+    uint32_t version;
+    // --shard of the run, 1 based
+    uint32_t shard;
+    uint32_t shardCount;
+    uint32_t reserved;
+};
+
+struct ColumnarChunkHeader {
+    uint32_t type;
+    uint32_t reserved;
+    // size of the payload, a multiple of 8
+    uint64_t size;
+};
+
+// payload of a dictionary chunk, followed by count + 1 uint32 offsets into
+// the string bytes that follow them
+struct ColumnarDictionaryHeader {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct ColumnarPartitionHeader {
+    int64_t timestamp;
+    uint32_t columnCount;
+    uint32_t reserved;
+};
+
+struct ColumnarColumnEntry {
+    uint16_t table;
+    uint16_t column;
+    uint32_t rows;
+    uint32_t encoding;
+    uint32_t reserved;
+    // added to ENCODING_DELTA32 values
+    int64_t base;
+    // from the start of the partition's payload
+    uint64_t offset;
+};
+
+// JSON name of a table's "_type" or of a column's key
+const char* tableName(Table table);
+const char* columnName(Column column);
+
+inline size_t align8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+
+#ifndef GITSTOCKCOLUMNARREADER_HH
+#define GITSTOCKCOLUMNARREADER_HH
+
+#include "ColumnarFormat.hh"
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+class ColumnarReaderImpl;
+
+//
+// One column of a partition, read in place from the mapped file. A column
+// the partition doesn't have has no rows.
+//
+class ColumnarColumn {
+public:
+    ColumnarColumn();
+    ColumnarColumn(const columnar::ColumnarColumnEntry *entry, const char *data);
+
+    bool exists() const;
+    size_t rows() const;
+    columnar::Encoding encoding() const;
+
+    // the value of any integer encoding, including dictionary ids and rows
+    int64_t integer(size_t row) const;
+    double real(size_t row) const;
+    // dictionary id of a string column
+    uint32_t id(size_t row) const;
+    // value of a text column
+    std::string text(size_t row) const;
+
+private:
+    const columnar::ColumnarColumnEntry *entry;
+    const char *data;
+};
+
+class ColumnarPartition {
+public:
+    ColumnarPartition(columnar::ChunkType type, const char *payload);
+
+    columnar::ChunkType type() const;
+    int64_t timestamp() const;
+    // rows of a table, 0 for a table the partition doesn't have
+    size_t rows(columnar::Table table) const;
+    ColumnarColumn column(columnar::Table table, columnar::Column column) const;
+
+private:
+    columnar::ChunkType chunkType;
+    const char *payload;
+};
+
+//
+// Memory maps a columnar history file. Opening only walks the chunk headers
+// and reads the dictionary; columns are read when they're asked for.
+//
+class ColumnarReader {
+public:
+    ColumnarReader();
+    ~ColumnarReader();
+
+    // false, with a message in error(), if path isn't a complete columnar
+    // file
+    bool open(const std::string& path);
+    const std::string& error() const;
+
+    const columnar::ColumnarFileHeader& header() const;
+
+    // partitions in timestamp order, each day's before its snapshot
+    size_t partitions() const;
+    const ColumnarPartition& partition(size_t index) const;
+
+    // dictionary
+    uint32_t strings() const;
+    std::string lookup(uint32_t id) const;
+    // id of value, NO_STRING if it isn't in the dictionary
+    uint32_t find(const std::string& value) const;
+
+private:
+    ColumnarReaderImpl *pImpl;
+};
+
+}
+
+#endif
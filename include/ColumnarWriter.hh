@@ -0,0 +1,44 @@
+
+#ifndef GITSTOCKCOLUMNARWRITER_HH
+#define GITSTOCKCOLUMNARWRITER_HH
+
+#include <string>
+
+namespace gitstock {
+
+class CommitDay;
+class TreeMetrics;
+class OutputWriter;
+class ColumnarWriterImpl;
+
+//
+// Renders history records in the columnar format of ColumnarFormat.hh, as
+// JsonReport does in JSON. Partitions are rendered concurrently into the
+// callers' buffers. Strings are looked up in a dictionary shared by all
+// threads; strings seen for the first time are defined in a dictionary
+// chunk that goes to the output right away, and so ahead of any partition
+// using them.
+//
+class ColumnarWriter {
+public:
+    ColumnarWriter();
+    ~ColumnarWriter();
+
+    // Continue the dictionary of the existing output at path, which is being
+    // resumed. Returns false with a message in error if it can't be read.
+    bool load(const std::string& path, std::string& error);
+    // where dictionary chunks are written
+    void output(OutputWriter *output);
+
+    // append the file header, which comes first in the output
+    void header(std::string& records) const;
+    void render(const CommitDay& day, std::string& records);
+    void render(const TreeMetrics& tree, std::string& records);
+
+private:
+    ColumnarWriterImpl *pImpl;
+};
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+
+#ifndef GITSTOCKCOMMITGRAPH_HH
+#define GITSTOCKCOMMITGRAPH_HH
+
+#include <stdint.h>
+#include <git2/oid.h>
+#include <git2/types.h>
+
+namespace gitstock {
+
+class CommitGraphImpl;
+
+//
+// Read-only view of the repository's commit-graph files
+// (objects/info/commit-graph or a split commit-graph chain). Commits are
+// addressed by their position in the graph; positions of all layers of a
+// chain form a single range with the base layer first. If the repository has
+// no usable commit-graph, loaded() is false and every lookup misses.
+//
+class CommitGraph {
+public:
+    static const uint32_t NO_POSITION = 0xffffffff;
+
+    CommitGraph(git_repository *repo);
+    ~CommitGraph();
+
+    bool loaded() const;
+    uint32_t commitCount() const;
+
+    // position of the commit, or NO_POSITION if the graph doesn't contain it
+    uint32_t find(const git_oid *id) const;
+
+    const git_oid* id(uint32_t pos) const;
+    int64_t commitTime(uint32_t pos) const;
+    uint32_t generation(uint32_t pos) const;
+    unsigned int parentCount(uint32_t pos) const;
+    uint32_t parent(uint32_t pos, unsigned int index) const;
+
+private:
+    CommitGraphImpl *pImpl;
+};
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+
+#ifndef GITSTOCKCOMMITSTORE_HH
+#define GITSTOCKCOMMITSTORE_HH
+
+#include <stdint.h>
+#include <git2/oid.h>
+#include <git2/repository.h>
+
+namespace gitstock {
+
+class CommitStoreImpl;
+
+struct CommitInfo {
+    int64_t timestamp;
+    // committer id in the AuthorTable
+    uint32_t author;
+};
+
+//
+// Thread shared table of commit metadata. Each commit is parsed once, the
+// first time a blame hunk references it, and every later lookup is served
+// from the table without touching libgit2.
+//
+class CommitStore {
+public:
+    static CommitStore& get();
+
+    bool lookup(git_repository *repo, const git_oid *id, CommitInfo& info);
+    int size() const;
+
+private:
+    CommitStore();
+    ~CommitStore();
+
+    CommitStoreImpl *pImpl;
+};
+
+}
+
+#endif
@@ -34,30 +34,63 @@
 #include <string>
 #include <stdint.h>
 #include <jsoncpp/json/json.h>
+#include <functional>
 
 namespace gitstock {
 
 class CommitTimelineImpl;
 class CommitDayImpl;
 
+//
+// The commits of a single snapshot: a day by default, or whatever bucket
+// Options.granularity selects. The last commit represents the snapshot. Only
+// the ids and commit times are kept until load() is called by whoever
+// processes the day; release() frees the loaded commits again.
+//
 class CommitDay {
 public:
-    CommitDay(int64_t timestamp, const std::vector<git_commit*>& commits);
+    CommitDay(git_repository *repo, int64_t timestamp, const git_oid *ids,
+              const int64_t *times, size_t count);
     virtual ~CommitDay();
     
     std::string date() const;
     std::string shortDay() const;
     int64_t timestamp() const;
+    size_t commitCount() const;
+    const git_oid* lastCommitId() const;
+    // last commit of the snapshot before, nullptr for the first one
+    const git_oid* previousCommitId() const;
+    void previousCommitId(const git_oid *id);
+    // time between the first and last commit
+    double commitSpanHours() const;
+
+    // valid between load() and release()
     const std::vector<git_commit*>& commits() const;
 
     int totalCommitCount() const;
     void totalCommitCount(int count);
+    // position in the timeline, oldest first
+    size_t sequence() const;
+    void sequence(size_t sequence);
     
     std::vector<git_commit*>::const_iterator begin() const;
     std::vector<git_commit*>::const_iterator end() const;
     
-    bool isPendingRelease() const;
+    bool load();
+    // look the commits up in repo, e.g. a worker's own handle, rather than
+    // the timeline's repository; nullptr for the timeline's
+    bool load(git_repository *repo);
     void release();
+    // Note the paths changed by the first-parent chain of this day's commits
+    // from the previous snapshot to the last commit; any other path has the
+    // same history in both snapshots. If the chain doesn't lead to the
+    // previous snapshot, e.g. when that is on another branch, every path
+    // counts as changed. Commits are looked up in repo, as for load().
+    void findChanges(git_repository *repo);
+    // whether path has the same history as in the previous snapshot
+    bool unchanged(const std::string& path) const;
+    // number of paths changed since the previous snapshot, -1 if unknown
+    int changeCount() const;
     
     Json::Value toJson() const;
     
@@ -76,6 +109,21 @@ public:
     std::vector<CommitDay*>::const_iterator begin() const;
     std::vector<CommitDay*>::const_iterator end() const;
     
+    // call CommitDay::findChanges() for every day, on threads
+    void findChanges(int threads);
+    // whether path has the same history in snapshot sequence as in the one
+    // before it
+    bool unchanged(size_t sequence, const std::string& path) const;
+    // hand out the most expensive of every window consecutive days first;
+    // otherwise pop() goes newest first
+    void schedule(int threads, size_t window);
+    // hand out the days oldest first
+    void scheduleOldestFirst();
+    // only hand out the days whose sequence modulo count is index
+    void shard(size_t index, size_t count);
+    // don't hand out the days for which done returns true
+    void skip(const std::function<bool(const CommitDay*)>& done);
+    int scheduledDays() const;
     CommitDay* pop();
     void release(CommitDay *day);
 
@@ -7,6 +7,7 @@
 #include <git2/tree.h>
 #include <git2/commit.h>
 #include "LineAgeMetrics.hh"
+#include "LineProvenance.hh"
 #include <jsoncpp/json/json.h>
 
 namespace gitstock {
@@ -18,7 +19,10 @@ class FileMetrics : public LineAgeMetrics {
 public:
     FileMetrics(const git_tree *tree, const std::string& path,
                 const git_commit *newestCommit = nullptr);
+    FileMetrics(const std::string& path, const LineOrigins& origins);
+    FileMetrics(const FileMetrics& other);
     virtual ~FileMetrics();
+    FileMetrics& operator=(const FileMetrics& other);
 
 	const std::string& path() const;
 
@@ -0,0 +1,51 @@
+
+#ifndef GITSTOCKFRAMECOMPRESSOR_HH
+#define GITSTOCKFRAMECOMPRESSOR_HH
+
+#include "Options.hh"
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+class FrameCompressorImpl;
+
+//
+// Compresses history output as a sequence of independently decodable frames,
+// so that frames can be compressed in parallel and a reader can seek to any
+// of them.
+//
+// gzip frames are members of a multi-member gzip file, which gzip and zcat
+// read as one stream. Each member carries its own length in a "GS" extra
+// subfield, which together with the size in its trailer lets a reader hop
+// from member to member. zstd frames are followed on close by a seek table
+// in the zstd seekable format.
+//
+class FrameCompressor {
+public:
+    FrameCompressor(Compression compression);
+    ~FrameCompressor();
+
+    // Append data compressed as one frame to frame. Safe to call from several
+    // threads at once.
+    bool compress(const char *data, size_t size, std::string& frame) const;
+    // note a frame written to the output for the seek table
+    void written(size_t size, size_t compressedSize);
+    // Rebuild the seek table from the first size bytes of an output that is
+    // being resumed. Returns false if they aren't complete frames.
+    bool scan(int fd, uint64_t size);
+    // append what ends the stream, if anything, to trailer
+    void finish(std::string& trailer);
+
+    // the compression a destination's file extension asks for
+    static Compression fromPath(const std::string& path);
+    static bool isAvailable(Compression compression);
+
+private:
+    FrameCompressorImpl *pImpl;
+};
+
+}
+
+#endif
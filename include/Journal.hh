@@ -0,0 +1,50 @@
+
+#ifndef GITSTOCKJOURNAL_HH
+#define GITSTOCKJOURNAL_HH
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+class JournalImpl;
+
+//
+// Checkpoint journal of a history run, kept next to the output file as
+// <output>.journal. The first line identifies the run (head commit and the
+// options that change which records are written); every following line holds
+// the sequence and timestamp of a day whose records were written, and the
+// size of the output file after them. A line is only added once the output up
+// to that size has been fsynced, so a resumed run can truncate the output to
+// the last recorded size and redo only the days not in the journal.
+//
+class Journal {
+public:
+    Journal(const std::string& outputPath, const std::string& run);
+    ~Journal();
+
+    // Read an existing journal. Returns false if it belongs to another run.
+    // A missing journal is an empty one.
+    bool load();
+    // Truncate the output to the journaled size and start appending to the
+    // journal; without a prior load() the journal starts empty.
+    bool open();
+
+    bool isDone(size_t sequence) const;
+    size_t doneCount() const;
+    uint64_t outputSize() const;
+
+    // Note that a day's records end at offset in the output. Entries are
+    // synced in batches, at most one second apart.
+    void record(size_t sequence, int64_t timestamp, uint64_t offset);
+    // sync the output and write out all recorded entries
+    void sync();
+
+private:
+    JournalImpl *pImpl;
+};
+
+}
+
+#endif
@@ -29,12 +29,17 @@
 #ifndef JSONREPORT_H
 #define JSONREPORT_H
 
+#include <string>
+#include <jsoncpp/json/json.h>
+
 namespace gitstock {
 
 class GitStockOptions;
 class CommitDay;
 class TreeMetrics;
 class JsonReportImpl;
+class OutputWriter;
+class ColumnarWriter;
 
 
 class JsonReport
@@ -45,6 +50,22 @@ public:
 
     void report(const CommitDay& day);
     void report(const TreeMetrics& metrics);
+    void report(const Json::Value& record);
+
+    // Append the records of a day or tree to records without writing them,
+    // so that callers can serialize concurrently into buffers they reuse and
+    // write() the result later.
+    void render(const CommitDay& day, std::string& records) const;
+    void render(const TreeMetrics& metrics, std::string& records) const;
+    // Write records, leaving an empty buffer in their place. When they
+    // belong to day, it is journaled once they are written. With --delta,
+    // days have to be written in timeline order: only the files that changed
+    // since the day written before are kept.
+    void write(std::string& records, const CommitDay *day = nullptr);
+    // send all output through a writer stage instead of Options.output
+    void output(OutputWriter *output);
+    // render days and trees in the columnar format instead of JSON
+    void columnar(ColumnarWriter *columnar);
 
 private:
     JsonReportImpl *pImpl;
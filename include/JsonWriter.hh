@@ -0,0 +1,45 @@
+
+#ifndef GITSTOCKJSONWRITER_HH
+#define GITSTOCKJSONWRITER_HH
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+//
+// Appends flat JSON records, one per line, to a caller owned buffer without
+// building a Json::Value. The output is byte for byte what jsoncpp's
+// StreamWriter writes with an empty indentation: keys in sorted order, no
+// spaces, doubles with 17 significant digits and everything outside of
+// printable ASCII escaped. jsoncpp sorts the keys itself; here the caller
+// has to add the fields in sorted order. Keys are written as given, so they
+// must not need escaping.
+//
+class JsonWriter {
+public:
+    JsonWriter(std::string& buffer);
+
+    void begin();
+    void field(const char *key, const std::string& value);
+    void field(const char *key, const char *value);
+    void field(const char *key, const char *value, size_t length);
+    void field(const char *key, int64_t value);
+    void field(const char *key, uint64_t value);
+    void field(const char *key, double value);
+    void field(const char *key, bool value);
+    // close the record and end its line
+    void end();
+
+private:
+    void key(const char *key);
+    void quoted(const char *value, size_t length);
+
+    std::string& buffer;
+    bool first;
+};
+
+}
+
+#endif
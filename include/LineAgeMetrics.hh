@@ -12,15 +12,34 @@ class Value;
 namespace gitstock {
 
 class LineAgeMetricsImpl;
+class LineAgeSketch;
+
+//
+// The line age fields of a report record, as plain integers. Ages that come
+// out negative (lines newer than the offset) are reported by magnitude.
+//
+struct LineAgeSummary {
+	uint64_t lineCount;
+	uint64_t firstCommitTimestamp;
+	uint64_t lastCommitTimestamp;
+	uint64_t mean;
+	uint64_t variance;
+	uint64_t standardDeviation;
+	bool hasPercentiles;
+	uint64_t median;
+	uint64_t p90;
+};
 
 class LineAgeMetrics {
 public:
 	LineAgeMetrics();
+	LineAgeMetrics(const LineAgeMetrics& other);
 	virtual ~LineAgeMetrics();
+	LineAgeMetrics& operator=(const LineAgeMetrics& other);
 
-	const mpz_class& lineCount() const;
-	const mpz_class& firstCommitTimestamp() const;
-	const mpz_class& lastCommitTimestamp() const;
+	mpz_class lineCount() const;
+	mpz_class firstCommitTimestamp() const;
+	mpz_class lastCommitTimestamp() const;
 	//mpz_class sum(const mpz_class& offset = 0) const;
 	//mpz_class sqsum(const mpz_class& offset = 0) const;
 
@@ -28,6 +47,11 @@ public:
 	mpz_class lineAgeVariance(const mpz_class& offset = 0) const;
 	mpz_class lineAgeStandardDeviation(const mpz_class& offset = 0) const;
 
+	// Approximate line age percentile (0 - 100), only available when
+	// Options.percentiles is set.
+	bool hasLineAgePercentiles() const;
+	mpz_class lineAgePercentile(double percentile, const mpz_class& offset = 0) const;
+
 	//mpz_class localSum() const;
 	//mpz_class localSqsum() const;
 	//mpz_class localMean() const;
@@ -38,9 +62,29 @@ public:
 	void updateLineAgeMetrics(const LineAgeMetrics& other);
     
     void toJson(Json::Value& json, const mpz_class& offset = 0) const;
+	// Everything toJson() reports. Computed in 128 bit integers unless the
+	// sums have been widened to GMP or an intermediate would overflow.
+	void summarize(LineAgeSummary& summary, const mpz_class& offset = 0) const;
 
 private:
-	LineAgeMetricsImpl *pImpl;
+	mpz_class sum() const;
+	mpz_class sqsum() const;
+	void widen();
+	bool summarizeFixed(LineAgeSummary& summary, int64_t offset) const;
+	uint64_t percentileAge(uint64_t timestamp, int64_t offset) const;
+
+	//
+	// Line ages are accumulated in fixed width integers. The GMP accumulators
+	// in wide are only allocated once a sum overflows (or always, when built
+	// with GITSTOCK_GMP_ACCUMULATORS) and then hold the sums from there on.
+	//
+	uint64_t count;
+	uint64_t first;
+	uint64_t last;
+	__int128 fixedSum;
+	__int128 fixedSqsum;
+	LineAgeMetricsImpl *wide;
+	LineAgeSketch *sketch;
 };
 
 }
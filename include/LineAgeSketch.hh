@@ -0,0 +1,45 @@
+
+#ifndef GITSTOCKLINEAGESKETCH_HH
+#define GITSTOCKLINEAGESKETCH_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <utility>
+
+namespace gitstock {
+
+//
+// Fixed memory, mergeable histogram of line timestamps used for percentile
+// line ages. Buckets start one second wide, so the sketch is exact until it
+// sees more than MAX_BUCKETS distinct timestamps. Past that, the bucket width
+// is doubled (merging neighbouring buckets) until everything fits again, so
+// the error of a quantile is bounded by the current bucket width.
+//
+class LineAgeSketch {
+public:
+    static const size_t MAX_BUCKETS = 128;
+
+    LineAgeSketch();
+
+    void add(uint64_t timestamp, uint64_t count);
+    void merge(const LineAgeSketch& other);
+
+    uint64_t count() const;
+
+    // Timestamp below which the given fraction of lines was committed.
+    uint64_t quantile(double fraction) const;
+
+private:
+    void collapse();
+
+    // bucket width is 2^shift seconds
+    unsigned int shift;
+    uint64_t total;
+    // (timestamp >> shift, line count), sorted by bucket
+    std::vector<std::pair<uint64_t, uint64_t>> buckets;
+};
+
+}
+
+#endif
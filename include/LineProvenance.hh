@@ -0,0 +1,66 @@
+
+#ifndef GITSTOCKLINEPROVENANCE_HH
+#define GITSTOCKLINEPROVENANCE_HH
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <git2/commit.h>
+
+namespace gitstock {
+
+// The commit that introduced a line.
+struct LineOrigin {
+    int64_t timestamp;
+    // committer id in the AuthorTable
+    uint32_t author;
+};
+
+typedef std::vector<LineOrigin> LineOrigins;
+
+//
+// Origins of every text file at a single commit. Unchanged files share their
+// origin arrays with the snapshots of the parent commits.
+//
+class ProvenanceSnapshot {
+public:
+    const LineOrigins* find(const std::string& path) const;
+    int fileCount() const;
+
+private:
+    friend class LineProvenanceImpl;
+    std::unordered_map<std::string, std::shared_ptr<const LineOrigins>> files;
+};
+
+class LineProvenanceImpl;
+
+//
+// Line attribution engine that walks history once, from the root commits
+// forward, applying each commit's tree diff to the line origins of every file
+// at the same time. This replaces one history walk per file (git blame) with
+// a single walk for the whole tree.
+//
+class LineProvenance {
+public:
+    // Return false to stop the walk.
+    typedef std::function<bool(git_commit *commit, const ProvenanceSnapshot& snapshot)> Visitor;
+
+    LineProvenance(git_commit *head);
+    ~LineProvenance();
+
+    int commits() const;
+
+    // Walk history up to head, calling visitor once the snapshot of each
+    // commit is known. Parents are always visited before their children.
+    void walk(const Visitor& visitor);
+
+private:
+    LineProvenanceImpl *pImpl;
+};
+
+}
+
+#endif
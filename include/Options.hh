@@ -9,6 +9,47 @@
 
 namespace gitstock {
 
+enum AttributionEngine {
+    // git blame for every file
+    ENGINE_BLAME,
+    // a single history walk for the whole tree
+    ENGINE_PROVENANCE
+};
+
+// how history mode groups commits into snapshots
+enum SnapshotGranularity {
+    GRANULARITY_COMMIT,
+    GRANULARITY_DAY,
+    GRANULARITY_WEEK,
+    GRANULARITY_MONTH,
+    // one snapshot per tagged commit, plus the commits since the last tag
+    GRANULARITY_TAG,
+    // daily for the last month, weekly for the last year, monthly before that
+    GRANULARITY_ADAPTIVE
+};
+
+// when history output written to a file is synced to disk
+enum FsyncPolicy {
+    FSYNC_NEVER,
+    // after every write
+    FSYNC_WRITE,
+    // once, when the output is closed
+    FSYNC_CLOSE
+};
+
+enum OutputFormat {
+    FORMAT_JSON,
+    // history records in the columnar format of ColumnarFormat.hh
+    FORMAT_COLUMNAR
+};
+
+// compression of history output written to a file
+enum Compression {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+};
+
 class GitStockOptions {
 public:
 	std::string repoPath;
@@ -22,6 +63,34 @@ public:
     bool pretty;
     bool history;
 	bool json;
+    AttributionEngine engine;
+    SnapshotGranularity granularity;
+    bool percentiles;
+    // resident memory budget for history mode in bytes, 0 for no limit
+    uint64_t maxMemory;
+    // libgit2 object cache and pack mmap limits in bytes, 0 to size them
+    // from the repository
+    uint64_t cacheSize;
+    uint64_t mmapLimit;
+    // largest single write of history output in bytes
+    uint64_t writeBuffer;
+    FsyncPolicy fsync;
+    Compression compression;
+    OutputFormat format;
+    // write history records in timeline order
+    bool ordered;
+    // --delta: write only the file records that changed since the previous
+    // snapshot, and all of them every keyframeInterval snapshots
+    bool delta;
+    size_t keyframeInterval;
+    // --shard: this run covers the days whose sequence % shardCount is shardIndex
+    size_t shardIndex;
+    size_t shardCount;
+    // --merge: combine the shard outputs in mergeInputs
+    bool merge;
+    // continue an interrupted history run from its journal
+    bool resume;
+    std::vector<std::string> mergeInputs;
     std::pair<std::string, std::string> resolveSignature(const std::string& email, const std::string& name) const;
 	std::ostream *output;
 
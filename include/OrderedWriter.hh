@@ -0,0 +1,42 @@
+
+#ifndef GITSTOCKORDEREDWRITER_HH
+#define GITSTOCKORDEREDWRITER_HH
+
+#include <string>
+#include <stddef.h>
+
+namespace gitstock {
+
+class JsonReport;
+class CommitDay;
+class OrderedWriterImpl;
+
+//
+// Reorder buffer for history output. Workers submit the rendered records of
+// each snapshot together with its sequence number and a single writer thread
+// emits them in sequence order. A worker blocks only while its sequence is
+// more than window snapshots ahead of the next one to be written; a window of
+// 0 never blocks.
+//
+class OrderedWriter {
+public:
+    // sequences before first are already written, e.g. by a resumed run
+    OrderedWriter(JsonReport& report, size_t count, size_t window, size_t first = 0);
+    ~OrderedWriter();
+
+    // records is taken over by the writer
+    void submit(size_t sequence, const CommitDay *day, std::string& records);
+    // whether submit() would return without waiting for the writer
+    bool canSubmit(size_t sequence);
+    // stop early, e.g. on interrupt; contiguous records are still written
+    void cancel();
+    // wait for the writer to finish
+    void close();
+
+private:
+    OrderedWriterImpl *pImpl;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+
+#ifndef GITSTOCKOUTPUTWRITER_HH
+#define GITSTOCKOUTPUTWRITER_HH
+
+#include "Options.hh"
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitstock {
+
+class CommitDay;
+class Journal;
+class FrameCompressor;
+class TaskPool;
+class OutputWriterImpl;
+
+//
+// Writer stage for history output to a file. Producers hand over complete
+// buffers, which only takes a swap under the queue lock; a dedicated thread
+// writes them out with writev, coalescing queued buffers into writes of up to
+// bufferSize bytes. A producer waits (a queue stall) while more than four
+// buffers' worth of data is queued. When the records of a day have been
+// written, the day is noted in the journal, if any.
+//
+// With a compressor, records are gathered into frames of about a megabyte
+// that are compressed on the pool, or on the producer's thread without one,
+// and written in the order they were filled. A day's records never span
+// frames, and a day is journaled with the offset of the end of its frame.
+//
+class OutputWriter {
+public:
+    // Takes over fd and compressor. offset is the current size of the output.
+    OutputWriter(int fd, size_t bufferSize, FsyncPolicy fsync, Journal *journal, uint64_t offset,
+                 FrameCompressor *compressor = nullptr, TaskPool *pool = nullptr);
+    // closes the writer
+    ~OutputWriter();
+
+    // Queue records, leaving an empty, recycled buffer in their place. day
+    // is journaled once they are written.
+    void write(std::string& records, const CommitDay *day = nullptr);
+    // Queue records without waiting for room in the queue, for small writes
+    // made while holding a lock that producers need.
+    void writeNow(std::string& records);
+    // write out everything queued and close the file
+    bool close();
+    // whether a write failed; records queued after that are dropped
+    bool failed() const;
+
+    uint64_t bytesWritten() const;
+    // size of the records before compression
+    uint64_t recordBytes() const;
+    // time spent in write and sync calls
+    int64_t writeMicroseconds() const;
+    int stalls() const;
+
+private:
+    OutputWriterImpl *pImpl;
+};
+
+}
+
+#endif
@@ -0,0 +1,23 @@
+
+#ifndef GITSTOCKSHARDMERGE_HH
+#define GITSTOCKSHARDMERGE_HH
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace gitstock {
+
+//
+// Combine the outputs of a sharded history run (--shard i/N) into the stream
+// a single --ordered run would have written. Every shard starts with a shard
+// record and holds the days whose timeline position modulo N is i - 1, oldest
+// first, so the merge takes one day from each shard in turn. Returns 0 on
+// success; missing, duplicate, mismatched or truncated shards are reported on
+// stderr and make it fail.
+//
+int mergeShards(const std::vector<std::string>& paths, std::ostream& output);
+
+}
+
+#endif
@@ -19,8 +19,13 @@ class Stock : public LineAgeMetrics {
 public:
     Stock(const git_signature *sig);
     Stock(const std::string& email, const std::string& name);
+    Stock(uint32_t author);
+    Stock(const Stock& other);
     virtual ~Stock();
+    Stock& operator=(const Stock& other);
 
+    // id in the AuthorTable
+    uint32_t author() const;
     const std::string& name() const;
     const std::string& email() const;
     double ownership() const;
@@ -40,7 +45,9 @@ class StockCollectionImpl;
 class StockCollection {
 public:
     StockCollection();
+    StockCollection(const StockCollection& other);
     virtual ~StockCollection();
+    StockCollection& operator=(const StockCollection& other);
 
     int count() const;
     std::vector<Stock*>::const_iterator begin() const;
@@ -49,6 +56,7 @@ public:
     void sort();
 
     Stock& find(const git_signature *sig);
+    Stock& find(uint32_t author);
     Stock& find(const Stock& stock);
 
     void update(const StockCollection& other);
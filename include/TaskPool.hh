@@ -0,0 +1,58 @@
+
+#ifndef GITSTOCKTASKPOOL_HH
+#define GITSTOCKTASKPOOL_HH
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace gitstock {
+
+class TaskPoolImpl;
+
+//
+// Work stealing pool shared by all levels of parallelism: history days and
+// the files of each tree are both tasks in the same pool, so the number of
+// busy threads never exceeds the pool size. Every worker has its own deque;
+// tasks submitted from a worker go to the back of its deque and are taken
+// from there again (newest first), while idle workers steal from the front
+// of the others (oldest first). Tasks submitted from outside the pool go to a
+// shared queue.
+//
+// Tasks must not block on each other; a task that has to wait uses
+// helpUntil() so that its thread keeps running other tasks meanwhile.
+//
+class TaskPool {
+public:
+    typedef std::function<void()> Task;
+
+    TaskPool(int threads);
+    // waits for all tasks
+    ~TaskPool();
+
+    int threads() const;
+
+    void submit(const Task& task);
+    // Run task(i) for every i in [0, count) in parallel and then continuation
+    // on the thread that finished the last one.
+    void parallel(size_t count, const std::function<void(size_t)>& task,
+                  const Task& continuation);
+    // Wait until done() returns true. A worker runs other tasks meanwhile;
+    // any other thread just waits, so the pool size stays the limit.
+    void helpUntil(const std::function<bool()>& done);
+    // wait until every submitted task has run
+    void wait();
+
+    // time spent running tasks, summed over all workers
+    int64_t busyMicroseconds() const;
+
+    // index of the calling worker thread, -1 outside of any pool
+    static int currentWorker();
+
+private:
+    TaskPoolImpl *pImpl;
+};
+
+}
+
+#endif
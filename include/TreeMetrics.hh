@@ -9,16 +9,24 @@
 #include <string>
 #include "LineAgeMetrics.hh"
 #include <jsoncpp/json/json.h>
+#include <functional>
 
 namespace gitstock {
 
 class FileMetrics;
 class TreeMetricsImpl;
 class StockCollection;
+class BlameCache;
+class ProvenanceSnapshot;
+class TaskPool;
 
 class TreeMetrics : public LineAgeMetrics {
 public:
-    TreeMetrics(const std::string& path, const git_tree *tree, const git_commit *newestCommit = nullptr);
+    // files are blamed as tasks on pool, or on the calling thread without one
+    TreeMetrics(const std::string& path, const git_tree *tree, const git_commit *newestCommit = nullptr,
+                TaskPool *pool = nullptr);
+    TreeMetrics(const std::string& path, const git_tree *tree, const ProvenanceSnapshot& provenance,
+                const git_commit *newestCommit = nullptr);
     virtual ~TreeMetrics();
     int fileCount() const;
 
@@ -32,8 +40,27 @@ public:
     Json::Value toJson(const mpz_class& offset = 0) const;
 
     int64_t timestamp() const;
+    // defaults to the day of the newest commit
+    void timestamp(int64_t timestamp);
+
+    // Start blaming the files of tree as tasks on pool and return at once.
+    // done is called with the finished metrics on one of the pool's threads,
+    // which is how a history day's aggregation runs as a continuation of its
+    // files. sequence is the snapshot's position in the history timeline,
+    // which the cache needs.
+    static void analyze(const std::string& path, const git_tree *tree,
+                        const git_commit *newestCommit, BlameCache *cache,
+                        size_t sequence, TaskPool& pool,
+                        const std::function<void(TreeMetrics*)>& done);
 
 private:
+    // constructs without analyzing the tree
+    struct Deferred {
+    };
+
+    TreeMetrics(Deferred, const std::string& path, const git_tree *tree,
+                const git_commit *newestCommit, BlameCache *cache, size_t sequence);
+
     TreeMetricsImpl *pImpl;
 };
 
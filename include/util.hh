@@ -6,14 +6,39 @@
 #include <stdint.h>
 #include <cmath>
 #include <gmpxx.h>
+#include <cstring>
+#include <git2/oid.h>
 
 struct git_commit;
 
 namespace gitstock {
 
+struct OidHash {
+    size_t operator() (const git_oid& oid) const {
+        size_t hash;
+        memcpy(&hash, oid.id, sizeof(hash));
+        return hash;
+    }
+};
+
+struct OidEqual {
+    bool operator() (const git_oid& left, const git_oid& right) const {
+        return !memcmp(left.id, right.id, GIT_OID_RAWSZ);
+    }
+};
+
 std::string formatDuration(mpz_class duration);
 std::string formatPercent(double value);
 int64_t getDayTimestamp(const git_commit *commit);
+int64_t getDayTimestamp(int64_t timestamp);
+// UTC start of the week (Monday) and month containing timestamp
+int64_t getWeekTimestamp(int64_t timestamp);
+int64_t getMonthTimestamp(int64_t timestamp);
+// current and peak resident set size of the process in bytes
+uint64_t getResidentMemory();
+uint64_t getPeakResidentMemory();
+// memory the system can hand out without swapping, 0 if unknown
+uint64_t getAvailableMemory();
 
 
 }
@@ -0,0 +1,125 @@
+
+#include "AuthorTable.hh"
+#include "Options.hh"
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+const uint32_t CHUNK_BITS = 10;
+const uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+const uint32_t MAX_CHUNKS = 4096;
+
+struct AuthorEntry {
+    string email;
+    string name;
+};
+
+}
+
+class AuthorTableImpl {
+public:
+    //
+    // Entries are stored in fixed size chunks that are never moved, so a
+    // reader holding an id can access its entry while another thread is
+    // interning new authors.
+    //
+    AuthorEntry *chunks[MAX_CHUNKS];
+    // resolved email -> id
+    unordered_map<string, uint32_t> ids;
+    // raw "email\0name" -> id, so each signature is resolved only once
+    unordered_map<string, uint32_t> signatures;
+    atomic<uint32_t> count;
+    mutex tableMutex;
+
+    AuthorTableImpl() : count(0) {
+        for(uint32_t i = 0; i < MAX_CHUNKS; ++i) {
+            chunks[i] = nullptr;
+        }
+    }
+
+    ~AuthorTableImpl() {
+        for(uint32_t i = 0; i < MAX_CHUNKS; ++i) {
+            delete[] chunks[i];
+        }
+    }
+
+    uint32_t intern(const string& email, const string& name) {
+        string key = email;
+        key += '\0';
+        key += name;
+
+        unique_lock<mutex> lock(tableMutex);
+        auto it = signatures.find(key);
+        if(it != signatures.end()) {
+            return it->second;
+        }
+
+        pair<string, string> resolved = Options.resolveSignature(email, name);
+        it = ids.find(resolved.first);
+        if(it != ids.end()) {
+            signatures[key] = it->second;
+            return it->second;
+        }
+
+        uint32_t id = count.load();
+        uint32_t chunk = id >> CHUNK_BITS;
+        if(chunk >= MAX_CHUNKS) {
+            throw overflow_error("too many authors");
+        }
+
+        if(!chunks[chunk]) {
+            chunks[chunk] = new AuthorEntry[CHUNK_SIZE];
+        }
+
+        AuthorEntry& entry = chunks[chunk][id & (CHUNK_SIZE - 1)];
+        entry.email = resolved.first;
+        entry.name = resolved.second;
+
+        ids[resolved.first] = id;
+        signatures[key] = id;
+        count.store(id + 1);
+
+        return id;
+    }
+
+    const AuthorEntry& entry(uint32_t id) const {
+        return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+    }
+};
+
+AuthorTable& AuthorTable::get() {
+    static AuthorTable table;
+    return table;
+}
+
+AuthorTable::AuthorTable() : pImpl(new AuthorTableImpl) {
+}
+
+AuthorTable::~AuthorTable() {
+    delete pImpl;
+}
+
+uint32_t AuthorTable::intern(const string& email, const string& name) {
+    return pImpl->intern(email, name);
+}
+
+const string& AuthorTable::email(uint32_t id) const {
+    return pImpl->entry(id).email;
+}
+
+const string& AuthorTable::name(uint32_t id) const {
+    return pImpl->entry(id).name;
+}
+
+uint32_t AuthorTable::count() const {
+    return pImpl->count.load();
+}
+
+}
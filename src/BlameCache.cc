@@ -0,0 +1,198 @@
+
+#include "BlameCache.hh"
+#include "FileMetrics.hh"
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <git2/oid.h>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+struct BlameCacheEntry {
+    git_oid blob;
+    // snapshots the result is valid for
+    size_t first;
+    size_t last;
+    // nullptr when the blob is binary
+    shared_ptr<const FileMetrics> metrics;
+};
+
+}
+
+class BlameCacheImpl {
+public:
+    // most recently used versions first
+    unordered_map<string, vector<BlameCacheEntry>> entries;
+    BlameCache::Unchanged unchanged;
+    int versionsPerPath;
+    mutex cacheMutex;
+    atomic_int hits;
+    atomic_int misses;
+
+    BlameCacheImpl(const BlameCache::Unchanged& unchanged, int versionsPerPath)
+        : unchanged(unchanged), versionsPerPath(versionsPerPath > 0 ? versionsPerPath : 1),
+        hits(0), misses(0) {
+    }
+
+    bool find(size_t sequence, const string& path, const git_oid *blob, FileMetrics **metrics) {
+        shared_ptr<const FileMetrics> cached;
+        bool found = false;
+
+        {
+            unique_lock<mutex> lock(cacheMutex);
+            auto it = entries.find(path);
+            if(it != entries.end()) {
+                vector<BlameCacheEntry>& versions = it->second;
+                for(size_t i = 0; i < versions.size(); ++i) {
+                    if(covers(versions[i], sequence, path, blob)) {
+                        cached = versions[i].metrics;
+                        use(versions, i, path, sequence);
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if(found) {
+            ++hits;
+            // copy outside of the lock, this is O(stocks in the file)
+            *metrics = cached ? new FileMetrics(*cached) : nullptr;
+        } else {
+            ++misses;
+        }
+
+        return found;
+    }
+
+    void insert(size_t sequence, const string& path, const git_oid *blob,
+                const FileMetrics *metrics) {
+        BlameCacheEntry entry;
+        git_oid_cpy(&entry.blob, blob);
+        entry.first = sequence;
+        entry.last = sequence;
+        if(metrics) {
+            entry.metrics = make_shared<const FileMetrics>(*metrics);
+        }
+
+        unique_lock<mutex> lock(cacheMutex);
+        vector<BlameCacheEntry>& versions = entries[path];
+
+        for(size_t i = 0; i < versions.size(); ++i) {
+            if(covers(versions[i], sequence, path, blob)) {
+                // another thread beat us to it
+                use(versions, i, path, sequence);
+                return;
+            }
+        }
+
+        versions.insert(versions.begin(), entry);
+        use(versions, 0, path, sequence);
+        if(versions.size() > versionsPerPath) {
+            versions.pop_back();
+        }
+    }
+
+    // whether path is unchanged in every snapshot after from up to to
+    bool unchangedBetween(size_t from, size_t to, const string& path) const {
+        for(size_t sequence = from + 1; sequence <= to; ++sequence) {
+            if(!unchanged(sequence, path)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool covers(const BlameCacheEntry& entry, size_t sequence, const string& path,
+                const git_oid *blob) const {
+        if(!git_oid_equal(&entry.blob, blob)) {
+            return false;
+        }
+
+        if(sequence < entry.first) {
+            return unchangedBetween(sequence, entry.first, path);
+        }
+
+        return sequence <= entry.last || unchangedBetween(entry.last, sequence, path);
+    }
+
+    //
+    // Grow the entry at index to include sequence and move it to the front,
+    // merging the entries for the same blob whose ranges now join up with
+    // it into one.
+    //
+    void use(vector<BlameCacheEntry>& versions, size_t index, const string& path,
+             size_t sequence) {
+        BlameCacheEntry entry = versions[index];
+
+        entry.first = min(entry.first, sequence);
+        entry.last = max(entry.last, sequence);
+
+        versions.erase(versions.begin() + index);
+        for(size_t i = 0; i < versions.size(); ) {
+            const BlameCacheEntry& other = versions[i];
+
+            if(covers(entry, other.first, path, &other.blob) ||
+               covers(entry, other.last, path, &other.blob)) {
+                entry.first = min(entry.first, other.first);
+                entry.last = max(entry.last, other.last);
+                versions.erase(versions.begin() + i);
+                // the grown range may join up with an entry already passed
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        versions.insert(versions.begin(), entry);
+    }
+
+    void clear() {
+        unordered_map<string, vector<BlameCacheEntry>> dropped;
+
+        {
+            unique_lock<mutex> lock(cacheMutex);
+            dropped.swap(entries);
+        }
+        // dropped is freed here, outside of the lock
+    }
+};
+
+BlameCache::BlameCache(const Unchanged& unchanged, int versionsPerPath)
+    : pImpl(new BlameCacheImpl(unchanged, versionsPerPath)) {
+}
+
+BlameCache::~BlameCache() {
+    delete pImpl;
+}
+
+bool BlameCache::find(size_t sequence, const string& path, const git_oid *blob,
+                      FileMetrics **metrics) {
+    return pImpl->find(sequence, path, blob, metrics);
+}
+
+void BlameCache::insert(size_t sequence, const string& path, const git_oid *blob,
+                        const FileMetrics *metrics) {
+    pImpl->insert(sequence, path, blob, metrics);
+}
+
+void BlameCache::clear() {
+    pImpl->clear();
+}
+
+int BlameCache::hits() const {
+    return pImpl->hits.load();
+}
+
+int BlameCache::misses() const {
+    return pImpl->misses.load();
+}
+
+}
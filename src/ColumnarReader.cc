@@ -0,0 +1,384 @@
+
+#include "ColumnarReader.hh"
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace gitstock {
+
+using namespace columnar;
+
+namespace {
+
+const char *TABLE_NAMES[TABLE_COUNT] = {
+    "commit-day", "commit", "tree", "file", "stock-file", "stock"
+};
+
+const char *COLUMN_NAMES[COLUMN_COUNT] = {
+    "Timestamp", "CommitCount", "CommitSpanHours", "TotalCommitCount", "AuthorEmail",
+    "AuthorName", "DayOfTheWeek", "HourOfTheDay", "Message", "FileCount", "FilePath", "File",
+    "FirstCommitTimestamp", "LastCommitTimestamp", "LineAgeMean", "LineAgeMedian", "LineAgeP90",
+    "LineAgeStandardDeviation", "LineAgeVariance", "LineCount", "Ownership"
+};
+
+// bytes taken by a column, 0 if the encoding is unknown
+uint64_t columnSize(const ColumnarColumnEntry& entry, const char *data, uint64_t available) {
+    uint64_t rows = entry.rows;
+
+    switch(entry.encoding) {
+    case ENCODING_INT64:
+    case ENCODING_UINT64:
+    case ENCODING_DOUBLE:
+        return rows * 8;
+    case ENCODING_DELTA32:
+    case ENCODING_STRING_ID:
+    case ENCODING_ROW:
+        return rows * 4;
+    case ENCODING_UINT8:
+        return rows;
+    case ENCODING_TEXT:
+        if((rows + 1) * 4 > available) {
+            return (rows + 1) * 4;
+        }
+        return (rows + 1) * 4 + ((const uint32_t*)data)[rows];
+    default:
+        return 0;
+    }
+}
+
+}
+
+const char* columnar::tableName(Table table) {
+    return table < TABLE_COUNT ? TABLE_NAMES[table] : "";
+}
+
+const char* columnar::columnName(Column column) {
+    return column < COLUMN_COUNT ? COLUMN_NAMES[column] : "";
+}
+
+ColumnarColumn::ColumnarColumn() : entry(nullptr), data(nullptr) {
+}
+
+ColumnarColumn::ColumnarColumn(const ColumnarColumnEntry *entry, const char *data)
+    : entry(entry), data(data) {
+}
+
+bool ColumnarColumn::exists() const {
+    return entry != nullptr;
+}
+
+size_t ColumnarColumn::rows() const {
+    return entry ? entry->rows : 0;
+}
+
+Encoding ColumnarColumn::encoding() const {
+    return (Encoding)entry->encoding;
+}
+
+int64_t ColumnarColumn::integer(size_t row) const {
+    switch(entry->encoding) {
+    case ENCODING_INT64:
+        return ((const int64_t*)data)[row];
+    case ENCODING_UINT64:
+        return ((const uint64_t*)data)[row];
+    case ENCODING_DOUBLE:
+        return ((const double*)data)[row];
+    case ENCODING_DELTA32:
+        return entry->base + ((const uint32_t*)data)[row];
+    case ENCODING_STRING_ID:
+    case ENCODING_ROW:
+        return ((const uint32_t*)data)[row];
+    case ENCODING_UINT8:
+        return ((const uint8_t*)data)[row];
+    default:
+        return 0;
+    }
+}
+
+double ColumnarColumn::real(size_t row) const {
+    switch(entry->encoding) {
+    case ENCODING_DOUBLE:
+        return ((const double*)data)[row];
+    case ENCODING_UINT64:
+        return ((const uint64_t*)data)[row];
+    default:
+        return integer(row);
+    }
+}
+
+uint32_t ColumnarColumn::id(size_t row) const {
+    return ((const uint32_t*)data)[row];
+}
+
+string ColumnarColumn::text(size_t row) const {
+    const uint32_t *offsets = (const uint32_t*)data;
+    const char *bytes = data + (entry->rows + 1) * 4;
+
+    if(offsets[row] > offsets[row + 1]) {
+        return string();
+    }
+
+    return string(bytes + offsets[row], offsets[row + 1] - offsets[row]);
+}
+
+ColumnarPartition::ColumnarPartition(ChunkType type, const char *payload)
+    : chunkType(type), payload(payload) {
+}
+
+ChunkType ColumnarPartition::type() const {
+    return chunkType;
+}
+
+int64_t ColumnarPartition::timestamp() const {
+    return ((const ColumnarPartitionHeader*)payload)->timestamp;
+}
+
+size_t ColumnarPartition::rows(Table table) const {
+    const ColumnarPartitionHeader *header = (const ColumnarPartitionHeader*)payload;
+    const ColumnarColumnEntry *entries = (const ColumnarColumnEntry*)(header + 1);
+
+    for(uint32_t i = 0; i < header->columnCount; ++i) {
+        if(entries[i].table == table) {
+            return entries[i].rows;
+        }
+    }
+
+    return 0;
+}
+
+ColumnarColumn ColumnarPartition::column(Table table, Column column) const {
+    const ColumnarPartitionHeader *header = (const ColumnarPartitionHeader*)payload;
+    const ColumnarColumnEntry *entries = (const ColumnarColumnEntry*)(header + 1);
+
+    for(uint32_t i = 0; i < header->columnCount; ++i) {
+        if(entries[i].table == table && entries[i].column == column) {
+            return ColumnarColumn(&entries[i], payload + entries[i].offset);
+        }
+    }
+
+    return ColumnarColumn();
+}
+
+class ColumnarReaderImpl {
+public:
+    const char *data;
+    uint64_t size;
+    string error;
+    vector<ColumnarPartition> partitions;
+    // start and length of every dictionary string
+    vector<pair<const char*, uint32_t>> strings;
+
+    ColumnarReaderImpl() : data(nullptr), size(0) {
+    }
+
+    ~ColumnarReaderImpl() {
+        if(data) {
+            munmap((void*)data, size);
+        }
+    }
+
+    bool fail(uint64_t offset, const string& message) {
+        ostringstream ss;
+
+        ss << message << " at offset " << offset;
+        error = ss.str();
+        return false;
+    }
+
+    bool open(const string& path) {
+        struct stat st;
+        int fd = ::open(path.c_str(), O_RDONLY);
+
+        if(fd < 0 || fstat(fd, &st)) {
+            error = "failed to open " + path + ": " + strerror(errno);
+            if(fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+
+        size = st.st_size;
+        if(size < sizeof(ColumnarFileHeader)) {
+            close(fd);
+            error = path + " is not a columnar history file";
+            return false;
+        }
+
+        void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) {
+            error = "failed to map " + path + ": " + strerror(errno);
+            return false;
+        }
+        data = (const char*)map;
+
+        const ColumnarFileHeader *header = (const ColumnarFileHeader*)data;
+        if(memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC))) {
+            error = path + " is not a columnar history file";
+            return false;
+        } else if(header->version != FORMAT_VERSION) {
+            error = path + " has an unsupported format version";
+            return false;
+        }
+
+        if(!readChunks()) {
+            return false;
+        }
+
+        // a stable sort keeps the days of equal timestamps in file order
+        stable_sort(partitions.begin(), partitions.end(),
+                    [](const ColumnarPartition& a, const ColumnarPartition& b) {
+            return a.timestamp() < b.timestamp() ||
+                (a.timestamp() == b.timestamp() && a.type() < b.type());
+        });
+
+        return true;
+    }
+
+    bool readChunks() {
+        uint64_t offset = sizeof(ColumnarFileHeader);
+
+        while(offset < size) {
+            const ColumnarChunkHeader *chunk = (const ColumnarChunkHeader*)(data + offset);
+
+            if(size - offset < sizeof(ColumnarChunkHeader) ||
+               chunk->size > size - offset - sizeof(ColumnarChunkHeader) || chunk->size % 8) {
+                return fail(offset, "truncated chunk");
+            }
+
+            const char *payload = (const char*)(chunk + 1);
+            switch(chunk->type) {
+            case CHUNK_DICTIONARY:
+                if(!readDictionary(payload, chunk->size)) {
+                    return fail(offset, "invalid dictionary");
+                }
+                break;
+            case CHUNK_DAY:
+            case CHUNK_SNAPSHOT:
+                if(!checkPartition(payload, chunk->size)) {
+                    return fail(offset, "invalid partition");
+                }
+                partitions.push_back(ColumnarPartition((ChunkType)chunk->type, payload));
+                break;
+            default:
+                // chunks of later versions are skipped
+                break;
+            }
+
+            offset += sizeof(ColumnarChunkHeader) + chunk->size;
+        }
+
+        return true;
+    }
+
+    bool readDictionary(const char *payload, uint64_t size) {
+        const ColumnarDictionaryHeader *header = (const ColumnarDictionaryHeader*)payload;
+
+        if(size < sizeof(*header) || header->first != strings.size() ||
+           (size - sizeof(*header)) / 4 < (uint64_t)header->count + 1) {
+            return false;
+        }
+
+        const uint32_t *offsets = (const uint32_t*)(header + 1);
+        const char *bytes = (const char*)(offsets + header->count + 1);
+        uint64_t available = payload + size - bytes;
+
+        for(uint32_t i = 0; i < header->count; ++i) {
+            if(offsets[i] > offsets[i + 1] || offsets[i + 1] > available) {
+                return false;
+            }
+            strings.push_back(make_pair(bytes + offsets[i], offsets[i + 1] - offsets[i]));
+        }
+
+        return true;
+    }
+
+    bool checkPartition(const char *payload, uint64_t size) {
+        const ColumnarPartitionHeader *header = (const ColumnarPartitionHeader*)payload;
+
+        if(size < sizeof(*header) ||
+           (size - sizeof(*header)) / sizeof(ColumnarColumnEntry) < header->columnCount) {
+            return false;
+        }
+
+        const ColumnarColumnEntry *entries = (const ColumnarColumnEntry*)(header + 1);
+        for(uint32_t i = 0; i < header->columnCount; ++i) {
+            const ColumnarColumnEntry& entry = entries[i];
+
+            if(entry.table >= TABLE_COUNT || entry.offset > size || entry.offset % 8) {
+                return false;
+            }
+
+            uint64_t available = size - entry.offset;
+            uint64_t length = columnSize(entry, payload + entry.offset, available);
+            if(!length && entry.rows) {
+                return false;
+            } else if(length > available) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+ColumnarReader::ColumnarReader() : pImpl(new ColumnarReaderImpl) {
+}
+
+ColumnarReader::~ColumnarReader() {
+    delete pImpl;
+}
+
+bool ColumnarReader::open(const string& path) {
+    return pImpl->open(path);
+}
+
+const string& ColumnarReader::error() const {
+    return pImpl->error;
+}
+
+const ColumnarFileHeader& ColumnarReader::header() const {
+    return *(const ColumnarFileHeader*)pImpl->data;
+}
+
+size_t ColumnarReader::partitions() const {
+    return pImpl->partitions.size();
+}
+
+const ColumnarPartition& ColumnarReader::partition(size_t index) const {
+    return pImpl->partitions[index];
+}
+
+uint32_t ColumnarReader::strings() const {
+    return pImpl->strings.size();
+}
+
+string ColumnarReader::lookup(uint32_t id) const {
+    if(id >= pImpl->strings.size()) {
+        return std::string();
+    }
+
+    return std::string(pImpl->strings[id].first, pImpl->strings[id].second);
+}
+
+uint32_t ColumnarReader::find(const std::string& value) const {
+    for(size_t id = 0; id < pImpl->strings.size(); ++id) {
+        if(pImpl->strings[id].second == value.size() &&
+           !memcmp(pImpl->strings[id].first, value.data(), value.size())) {
+            return id;
+        }
+    }
+
+    return NO_STRING;
+}
+
+}
@@ -0,0 +1,497 @@
+
+#include "ColumnarWriter.hh"
+#include "ColumnarFormat.hh"
+#include "ColumnarReader.hh"
+#include "CommitTimeline.hh"
+#include "TreeMetrics.hh"
+#include "FileMetrics.hh"
+#include "Stock.hh"
+#include "OutputWriter.hh"
+#include "Options.hh"
+#include <git2.h>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+
+namespace gitstock {
+
+using namespace columnar;
+
+namespace {
+
+//
+// Appends one partition chunk to a buffer. The column directory is reserved
+// up front and filled in as the columns are appended after it.
+//
+class PartitionBuilder {
+public:
+    PartitionBuilder(string& records, ChunkType type, int64_t timestamp, size_t columns)
+        : records(records), start(records.size()), next(0) {
+        ColumnarChunkHeader chunk;
+        ColumnarPartitionHeader partition;
+
+        memset(&chunk, 0, sizeof(chunk));
+        chunk.type = type;
+        memset(&partition, 0, sizeof(partition));
+        partition.timestamp = timestamp;
+        partition.columnCount = columns;
+
+        records.append((const char*)&chunk, sizeof(chunk));
+        records.append((const char*)&partition, sizeof(partition));
+        records.append(columns * sizeof(ColumnarColumnEntry), '\0');
+    }
+
+    template<typename T>
+    void column(Table table, Column column, Encoding encoding, const vector<T>& values) {
+        entry(table, column, values.size(), encoding, 0);
+        append(values.data(), values.size() * sizeof(T));
+    }
+
+    //
+    // Timestamps are stored as 32 bit offsets from the smallest one, unless
+    // they span more than that.
+    //
+    void timestamps(Table table, Column column, const vector<int64_t>& values) {
+        int64_t base = 0;
+        int64_t top = 0;
+
+        for(size_t i = 0; i < values.size(); ++i) {
+            if(!i || values[i] < base) {
+                base = values[i];
+            }
+            if(!i || values[i] > top) {
+                top = values[i];
+            }
+        }
+
+        if((uint64_t)(top - base) > 0xffffffff) {
+            this->column(table, column, ENCODING_INT64, values);
+            return;
+        }
+
+        entry(table, column, values.size(), ENCODING_DELTA32, base);
+        for(int64_t value : values) {
+            uint32_t delta = value - base;
+            records.append((const char*)&delta, sizeof(delta));
+        }
+        pad();
+    }
+
+    void text(Table table, Column column, const vector<const char*>& values) {
+        uint32_t offset = 0;
+
+        entry(table, column, values.size(), ENCODING_TEXT, 0);
+
+        records.append((const char*)&offset, sizeof(offset));
+        for(const char *value : values) {
+            offset += strlen(value);
+            records.append((const char*)&offset, sizeof(offset));
+        }
+
+        for(const char *value : values) {
+            records.append(value);
+        }
+        pad();
+    }
+
+    // fill in the size of the chunk once all columns are appended
+    void finish() {
+        uint64_t size = records.size() - start - sizeof(ColumnarChunkHeader);
+
+        memcpy(&records[start + offsetof(ColumnarChunkHeader, size)], &size, sizeof(size));
+    }
+
+private:
+    void entry(Table table, Column column, size_t rows, Encoding encoding, int64_t base) {
+        ColumnarColumnEntry entry;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.table = table;
+        entry.column = column;
+        entry.rows = rows;
+        entry.encoding = encoding;
+        entry.base = base;
+        entry.offset = records.size() - start - sizeof(ColumnarChunkHeader);
+
+        memcpy(&records[start + sizeof(ColumnarChunkHeader) + sizeof(ColumnarPartitionHeader) +
+                        next * sizeof(ColumnarColumnEntry)], &entry, sizeof(entry));
+        ++next;
+    }
+
+    void append(const void *data, size_t size) {
+        records.append((const char*)data, size);
+        pad();
+    }
+
+    void pad() {
+        records.append(align8(records.size()) - records.size(), '\0');
+    }
+
+    string& records;
+    size_t start;
+    // directory entries filled in so far
+    size_t next;
+};
+
+// the strings this thread has already resolved, so that the shared
+// dictionary is only locked for new ones
+struct ThreadDictionary {
+    const ColumnarWriterImpl *owner;
+    unordered_map<string, uint32_t> ids;
+
+    ThreadDictionary() : owner(nullptr) {
+    }
+};
+
+thread_local ThreadDictionary threadDictionary;
+
+void appendDictionary(string& chunk, uint32_t first, const vector<const string*>& strings) {
+    ColumnarChunkHeader header;
+    ColumnarDictionaryHeader dictionary;
+    size_t bytes = 0;
+    uint32_t offset = 0;
+
+    for(const string *value : strings) {
+        bytes += value->size();
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.type = CHUNK_DICTIONARY;
+    header.size = align8(sizeof(dictionary) + (strings.size() + 1) * sizeof(uint32_t) + bytes);
+    dictionary.first = first;
+    dictionary.count = strings.size();
+
+    chunk.append((const char*)&header, sizeof(header));
+    chunk.append((const char*)&dictionary, sizeof(dictionary));
+
+    chunk.append((const char*)&offset, sizeof(offset));
+    for(const string *value : strings) {
+        offset += value->size();
+        chunk.append((const char*)&offset, sizeof(offset));
+    }
+
+    for(const string *value : strings) {
+        chunk.append(*value);
+    }
+    chunk.append(align8(chunk.size()) - chunk.size(), '\0');
+}
+
+}
+
+class ColumnarWriterImpl {
+public:
+    mutex dictionaryMutex;
+    unordered_map<string, uint32_t> dictionary;
+    OutputWriter *output;
+
+    ColumnarWriterImpl() : output(nullptr) {
+    }
+
+    //
+    // Resolve strings, which may be null, to dictionary ids. New strings are
+    // defined in a dictionary chunk that is queued while the dictionary is
+    // still locked, so no other thread can queue a partition using them
+    // ahead of it.
+    //
+    void intern(const vector<const string*>& strings, vector<uint32_t>& ids) {
+        ThreadDictionary& local = threadDictionary;
+        vector<size_t> missing;
+
+        if(local.owner != this) {
+            local.ids.clear();
+            local.owner = this;
+        }
+
+        ids.resize(strings.size());
+        for(size_t i = 0; i < strings.size(); ++i) {
+            if(!strings[i]) {
+                ids[i] = NO_STRING;
+                continue;
+            }
+
+            unordered_map<string, uint32_t>::const_iterator it = local.ids.find(*strings[i]);
+            if(it != local.ids.end()) {
+                ids[i] = it->second;
+            } else {
+                missing.push_back(i);
+            }
+        }
+
+        if(missing.empty()) {
+            return;
+        }
+
+        {
+            unique_lock<mutex> lock(dictionaryMutex);
+            vector<const string*> defined;
+            uint32_t first = dictionary.size();
+
+            for(size_t i : missing) {
+                pair<unordered_map<string, uint32_t>::iterator, bool> inserted =
+                    dictionary.insert(make_pair(*strings[i], (uint32_t)dictionary.size()));
+                if(inserted.second) {
+                    defined.push_back(&inserted.first->first);
+                }
+                ids[i] = inserted.first->second;
+            }
+
+            if(!defined.empty()) {
+                string chunk;
+                appendDictionary(chunk, first, defined);
+                // waiting for room in the queue could run tasks that need
+                // the dictionary
+                output->writeNow(chunk);
+            }
+        }
+
+        for(size_t i : missing) {
+            local.ids[*strings[i]] = ids[i];
+        }
+    }
+
+    static void lineAge(PartitionBuilder& partition, Table table,
+                        const vector<LineAgeSummary>& summaries) {
+        vector<int64_t> first;
+        vector<int64_t> last;
+
+        for(const LineAgeSummary& summary : summaries) {
+            first.push_back(summary.firstCommitTimestamp);
+            last.push_back(summary.lastCommitTimestamp);
+        }
+
+        partition.timestamps(table, COLUMN_FIRST_COMMIT_TIMESTAMP, first);
+        partition.timestamps(table, COLUMN_LAST_COMMIT_TIMESTAMP, last);
+        summaryColumn(partition, table, COLUMN_LINE_AGE_MEAN, summaries, &LineAgeSummary::mean);
+        if(Options.percentiles) {
+            summaryColumn(partition, table, COLUMN_LINE_AGE_MEDIAN, summaries,
+                          &LineAgeSummary::median);
+            summaryColumn(partition, table, COLUMN_LINE_AGE_P90, summaries,
+                          &LineAgeSummary::p90);
+        }
+        summaryColumn(partition, table, COLUMN_LINE_AGE_STANDARD_DEVIATION, summaries,
+                      &LineAgeSummary::standardDeviation);
+        summaryColumn(partition, table, COLUMN_LINE_AGE_VARIANCE, summaries,
+                      &LineAgeSummary::variance);
+        summaryColumn(partition, table, COLUMN_LINE_COUNT, summaries,
+                      &LineAgeSummary::lineCount);
+    }
+
+    static void summaryColumn(PartitionBuilder& partition, Table table, Column column,
+                              const vector<LineAgeSummary>& summaries,
+                              uint64_t LineAgeSummary::*field) {
+        vector<uint64_t> values;
+
+        values.reserve(summaries.size());
+        for(const LineAgeSummary& summary : summaries) {
+            values.push_back(summary.*field);
+        }
+
+        partition.column(table, column, ENCODING_UINT64, values);
+    }
+
+    static size_t lineAgeColumns() {
+        return Options.percentiles ? 8 : 6;
+    }
+
+    void render(const CommitDay& day, string& records) {
+        const vector<git_commit*>& commits = day.commits();
+        vector<pair<string, string>> authors;
+        vector<const string*> strings;
+        vector<uint32_t> ids;
+        vector<int64_t> timestamps;
+        vector<uint32_t> emails;
+        vector<uint32_t> names;
+        vector<uint8_t> weekDays;
+        vector<uint8_t> hours;
+        vector<const char*> messages;
+
+        // strings points into authors
+        authors.reserve(commits.size());
+
+        for(git_commit *commit : commits) {
+            const git_signature *sig = git_commit_committer(commit);
+            int64_t timestamp = git_commit_time(commit);
+            time_t time = timestamp;
+            tm local;
+            tm *t = localtime_r(&time, &local);
+            const char *msg = git_commit_message(commit);
+
+            if(sig) {
+                authors.push_back(Options.resolveSignature(sig->email, sig->name));
+                strings.push_back(&authors.back().first);
+                strings.push_back(&authors.back().second);
+            } else {
+                strings.push_back(nullptr);
+                strings.push_back(nullptr);
+            }
+
+            timestamps.push_back(timestamp);
+            weekDays.push_back(t->tm_wday);
+            hours.push_back(t->tm_hour);
+            messages.push_back(msg ? msg : "");
+        }
+
+        intern(strings, ids);
+        for(size_t i = 0; i < commits.size(); ++i) {
+            emails.push_back(ids[i * 2]);
+            names.push_back(ids[i * 2 + 1]);
+        }
+
+        PartitionBuilder partition(records, CHUNK_DAY, day.timestamp(), 9);
+
+        partition.column(TABLE_COMMIT_DAY, COLUMN_COMMIT_COUNT, ENCODING_INT64,
+                         vector<int64_t>(1, (int)day.commitCount()));
+        partition.column(TABLE_COMMIT_DAY, COLUMN_COMMIT_SPAN_HOURS, ENCODING_DOUBLE,
+                         vector<double>(1, day.commitSpanHours()));
+        partition.column(TABLE_COMMIT_DAY, COLUMN_TOTAL_COMMIT_COUNT, ENCODING_INT64,
+                         vector<int64_t>(1, day.totalCommitCount()));
+
+        partition.timestamps(TABLE_COMMIT, COLUMN_TIMESTAMP, timestamps);
+        partition.column(TABLE_COMMIT, COLUMN_AUTHOR_EMAIL, ENCODING_STRING_ID, emails);
+        partition.column(TABLE_COMMIT, COLUMN_AUTHOR_NAME, ENCODING_STRING_ID, names);
+        partition.column(TABLE_COMMIT, COLUMN_DAY_OF_THE_WEEK, ENCODING_UINT8, weekDays);
+        partition.column(TABLE_COMMIT, COLUMN_HOUR_OF_THE_DAY, ENCODING_UINT8, hours);
+        partition.text(TABLE_COMMIT, COLUMN_MESSAGE, messages);
+
+        partition.finish();
+    }
+
+    void render(const TreeMetrics& tree, string& records) {
+        mpz_class offset = Options.nowTimestamp ? Options.nowTimestamp : tree.lastCommitTimestamp();
+        vector<LineAgeSummary> treeSummary(1);
+        vector<LineAgeSummary> fileSummaries;
+        vector<LineAgeSummary> stockFileSummaries;
+        vector<LineAgeSummary> stockSummaries;
+        vector<uint32_t> stockFiles;
+        vector<double> stockFileOwnership;
+        vector<double> stockOwnership;
+        // file paths, then the email and name of every stock-file and stock
+        vector<const string*> strings;
+        vector<uint32_t> ids;
+        vector<uint32_t> paths;
+        vector<uint32_t> stockFileEmails;
+        vector<uint32_t> stockFileNames;
+        vector<uint32_t> stockEmails;
+        vector<uint32_t> stockNames;
+        size_t files = 0;
+
+        tree.summarize(treeSummary[0], offset);
+
+        for(const FileMetrics *file : tree) {
+            fileSummaries.push_back(LineAgeSummary());
+            file->summarize(fileSummaries.back(), offset);
+            strings.push_back(&file->path());
+        }
+
+        for(const FileMetrics *file : tree) {
+            for(const Stock *stock : file->stocks()) {
+                stockFileSummaries.push_back(LineAgeSummary());
+                stock->summarize(stockFileSummaries.back(), offset);
+                stockFiles.push_back(files);
+                stockFileOwnership.push_back(stock->ownership());
+                strings.push_back(&stock->email());
+                strings.push_back(&stock->name());
+            }
+            ++files;
+        }
+
+        for(const Stock *stock : tree.stocks()) {
+            stockSummaries.push_back(LineAgeSummary());
+            stock->summarize(stockSummaries.back(), offset);
+            stockOwnership.push_back(stock->ownership());
+            strings.push_back(&stock->email());
+            strings.push_back(&stock->name());
+        }
+
+        intern(strings, ids);
+
+        vector<uint32_t>::const_iterator id = ids.begin();
+        paths.assign(id, id + files);
+        id += files;
+        for(size_t i = 0; i < stockFiles.size(); ++i) {
+            stockFileEmails.push_back(*id++);
+            stockFileNames.push_back(*id++);
+        }
+        for(size_t i = 0; i < stockOwnership.size(); ++i) {
+            stockEmails.push_back(*id++);
+            stockNames.push_back(*id++);
+        }
+
+        PartitionBuilder partition(records, CHUNK_SNAPSHOT, tree.timestamp(),
+                                   9 + 4 * lineAgeColumns());
+
+        partition.column(TABLE_TREE, COLUMN_FILE_COUNT, ENCODING_INT64,
+                         vector<int64_t>(1, tree.fileCount()));
+        lineAge(partition, TABLE_TREE, treeSummary);
+
+        partition.column(TABLE_FILE, COLUMN_FILE_PATH, ENCODING_STRING_ID, paths);
+        lineAge(partition, TABLE_FILE, fileSummaries);
+
+        partition.column(TABLE_STOCK_FILE, COLUMN_FILE, ENCODING_ROW, stockFiles);
+        partition.column(TABLE_STOCK_FILE, COLUMN_AUTHOR_EMAIL, ENCODING_STRING_ID,
+                         stockFileEmails);
+        partition.column(TABLE_STOCK_FILE, COLUMN_AUTHOR_NAME, ENCODING_STRING_ID, stockFileNames);
+        lineAge(partition, TABLE_STOCK_FILE, stockFileSummaries);
+        partition.column(TABLE_STOCK_FILE, COLUMN_OWNERSHIP, ENCODING_DOUBLE, stockFileOwnership);
+
+        partition.column(TABLE_STOCK, COLUMN_AUTHOR_EMAIL, ENCODING_STRING_ID, stockEmails);
+        partition.column(TABLE_STOCK, COLUMN_AUTHOR_NAME, ENCODING_STRING_ID, stockNames);
+        lineAge(partition, TABLE_STOCK, stockSummaries);
+        partition.column(TABLE_STOCK, COLUMN_OWNERSHIP, ENCODING_DOUBLE, stockOwnership);
+
+        partition.finish();
+    }
+};
+
+ColumnarWriter::ColumnarWriter() : pImpl(new ColumnarWriterImpl) {
+}
+
+ColumnarWriter::~ColumnarWriter() {
+    delete pImpl;
+}
+
+bool ColumnarWriter::load(const string& path, string& error) {
+    ColumnarReader reader;
+
+    if(!reader.open(path)) {
+        error = reader.error();
+        return false;
+    }
+
+    for(uint32_t id = 0; id < reader.strings(); ++id) {
+        pImpl->dictionary.insert(make_pair(reader.lookup(id), id));
+    }
+
+    return true;
+}
+
+void ColumnarWriter::output(OutputWriter *output) {
+    pImpl->output = output;
+}
+
+void ColumnarWriter::header(string& records) const {
+    ColumnarFileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = FORMAT_VERSION;
+    header.shard = Options.shardIndex + 1;
+    header.shardCount = Options.shardCount;
+
+    records.append((const char*)&header, sizeof(header));
+}
+
+void ColumnarWriter::render(const CommitDay& day, string& records) {
+    pImpl->render(day, records);
+}
+
+void ColumnarWriter::render(const TreeMetrics& tree, string& records) {
+    pImpl->render(tree, records);
+}
+
+}
@@ -0,0 +1,318 @@
+
+#include "CommitGraph.hh"
+#include <git2/repository.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+const uint32_t GRAPH_SIGNATURE = 0x43475048; // "CGPH"
+const uint32_t CHUNK_OID_FANOUT = 0x4f494446; // "OIDF"
+const uint32_t CHUNK_OID_LOOKUP = 0x4f49444c; // "OIDL"
+const uint32_t CHUNK_COMMIT_DATA = 0x43444154; // "CDAT"
+const uint32_t CHUNK_EXTRA_EDGES = 0x45444745; // "EDGE"
+
+const uint32_t GRAPH_PARENT_NONE = 0x70000000;
+const uint32_t GRAPH_EXTRA_EDGES = 0x80000000;
+const uint32_t GRAPH_EDGE_MASK = 0x7fffffff;
+
+const size_t HEADER_SIZE = 8;
+const size_t CHUNK_ENTRY_SIZE = 12;
+const size_t FANOUT_SIZE = 256 * 4;
+// tree id, two parent positions, generation and commit time
+const size_t COMMIT_DATA_SIZE = GIT_OID_RAWSZ + 16;
+
+uint32_t readBigEndian32(const uint8_t *data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+        ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+uint64_t readBigEndian64(const uint8_t *data) {
+    return ((uint64_t)readBigEndian32(data) << 32) | readBigEndian32(data + 4);
+}
+
+//
+// A single memory mapped commit-graph file. base is the number of commits in
+// the layers below this one.
+//
+struct GraphLayer {
+    void *map;
+    size_t size;
+    uint32_t count;
+    uint32_t base;
+    const uint8_t *fanout;
+    const uint8_t *oids;
+    const uint8_t *commits;
+    const uint8_t *edges;
+    size_t edgeCount;
+
+    GraphLayer() : map(nullptr), size(0), count(0), base(0), fanout(nullptr),
+        oids(nullptr), commits(nullptr), edges(nullptr), edgeCount(0) {
+    }
+};
+
+}
+
+class CommitGraphImpl {
+public:
+    vector<GraphLayer> layers;
+    uint32_t count;
+
+    CommitGraphImpl(git_repository *repo) : count(0) {
+        string info = git_repository_commondir(repo);
+        info += "objects/info/";
+
+        if(!loadChain(info + "commit-graphs/")) {
+            GraphLayer layer;
+            if(mapLayer(info + "commit-graph", layer)) {
+                layers.push_back(layer);
+                count = layer.count;
+            }
+        }
+    }
+
+    ~CommitGraphImpl() {
+        for(GraphLayer& layer : layers) {
+            munmap(layer.map, layer.size);
+        }
+    }
+
+    //
+    // commit-graph-chain lists the layers of a split graph, base first. Only
+    // the layers up to the first one that can't be read are used; commits in
+    // the missing layers fall back to object parsing.
+    //
+    bool loadChain(const string& dir) {
+        ifstream chain((dir + "commit-graph-chain").c_str());
+        string hash;
+
+        while(getline(chain, hash)) {
+            GraphLayer layer;
+
+            if(hash.empty()) {
+                continue;
+            }
+
+            if(!mapLayer(dir + "graph-" + hash + ".graph", layer)) {
+                break;
+            }
+
+            layer.base = count;
+            count += layer.count;
+            layers.push_back(layer);
+        }
+
+        return !layers.empty();
+    }
+
+    bool mapLayer(const string& path, GraphLayer& layer) {
+        struct stat st;
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if(fd < 0) {
+            return false;
+        }
+
+        if(fstat(fd, &st) || (size_t)st.st_size < HEADER_SIZE + CHUNK_ENTRY_SIZE) {
+            close(fd);
+            return false;
+        }
+
+        layer.size = st.st_size;
+        layer.map = mmap(nullptr, layer.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if(layer.map == MAP_FAILED) {
+            return false;
+        }
+
+        if(!parseLayer(layer)) {
+            munmap(layer.map, layer.size);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool parseLayer(GraphLayer& layer) {
+        const uint8_t *data = (const uint8_t*)layer.map;
+        size_t commitDataSize = 0;
+
+        // signature, version 1, SHA-1
+        if(readBigEndian32(data) != GRAPH_SIGNATURE || data[4] != 1 || data[5] != 1) {
+            return false;
+        }
+
+        size_t chunks = data[6];
+        if(HEADER_SIZE + (chunks + 1) * CHUNK_ENTRY_SIZE > layer.size) {
+            return false;
+        }
+
+        // each chunk runs until the offset of the next entry in the table
+        for(size_t i = 0; i < chunks; ++i) {
+            const uint8_t *entry = data + HEADER_SIZE + i * CHUNK_ENTRY_SIZE;
+            uint32_t id = readBigEndian32(entry);
+            uint64_t offset = readBigEndian64(entry + 4);
+            uint64_t end = readBigEndian64(entry + 4 + CHUNK_ENTRY_SIZE);
+
+            if(offset > end || end > layer.size) {
+                return false;
+            }
+
+            switch(id) {
+            case CHUNK_OID_FANOUT:
+                if(end - offset != FANOUT_SIZE) {
+                    return false;
+                }
+                layer.fanout = data + offset;
+                break;
+            case CHUNK_OID_LOOKUP:
+                layer.oids = data + offset;
+                layer.count = (end - offset) / GIT_OID_RAWSZ;
+                break;
+            case CHUNK_COMMIT_DATA:
+                layer.commits = data + offset;
+                commitDataSize = end - offset;
+                break;
+            case CHUNK_EXTRA_EDGES:
+                layer.edges = data + offset;
+                layer.edgeCount = (end - offset) / 4;
+                break;
+            }
+        }
+
+        return layer.fanout && layer.oids && layer.commits &&
+            readBigEndian32(layer.fanout + 255 * 4) == layer.count &&
+            commitDataSize == (size_t)layer.count * COMMIT_DATA_SIZE;
+    }
+
+    const GraphLayer& layer(uint32_t pos) const {
+        size_t i = layers.size() - 1;
+        while(i > 0 && pos < layers[i].base) {
+            --i;
+        }
+
+        return layers[i];
+    }
+
+    const uint8_t* commitData(uint32_t pos) const {
+        const GraphLayer& l = layer(pos);
+        return l.commits + (size_t)(pos - l.base) * COMMIT_DATA_SIZE;
+    }
+
+    uint32_t find(const git_oid *id) const {
+        uint8_t first = id->id[0];
+
+        for(const GraphLayer& layer : layers) {
+            uint32_t low = first ? readBigEndian32(layer.fanout + (first - 1) * 4) : 0;
+            uint32_t high = readBigEndian32(layer.fanout + first * 4);
+
+            while(low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                int cmp = memcmp(id->id, layer.oids + (size_t)mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+
+                if(!cmp) {
+                    return layer.base + mid;
+                } else if(cmp < 0) {
+                    high = mid;
+                } else {
+                    low = mid + 1;
+                }
+            }
+        }
+
+        return CommitGraph::NO_POSITION;
+    }
+
+    uint32_t edge(uint32_t pos, size_t index) const {
+        const GraphLayer& l = layer(pos);
+        return index < l.edgeCount ? readBigEndian32(l.edges + index * 4) : GRAPH_EXTRA_EDGES;
+    }
+};
+
+CommitGraph::CommitGraph(git_repository *repo) : pImpl(new CommitGraphImpl(repo)) {
+}
+
+CommitGraph::~CommitGraph() {
+    delete pImpl;
+}
+
+bool CommitGraph::loaded() const {
+    return !pImpl->layers.empty();
+}
+
+uint32_t CommitGraph::commitCount() const {
+    return pImpl->count;
+}
+
+uint32_t CommitGraph::find(const git_oid *id) const {
+    return pImpl->find(id);
+}
+
+const git_oid* CommitGraph::id(uint32_t pos) const {
+    const GraphLayer& layer = pImpl->layer(pos);
+    return (const git_oid*)(layer.oids + (size_t)(pos - layer.base) * GIT_OID_RAWSZ);
+}
+
+int64_t CommitGraph::commitTime(uint32_t pos) const {
+    const uint8_t *data = pImpl->commitData(pos) + GIT_OID_RAWSZ + 8;
+    // the low two bits of the generation word are the top of the 34 bit time
+    return ((int64_t)(readBigEndian32(data) & 0x3) << 32) | readBigEndian32(data + 4);
+}
+
+uint32_t CommitGraph::generation(uint32_t pos) const {
+    return readBigEndian32(pImpl->commitData(pos) + GIT_OID_RAWSZ + 8) >> 2;
+}
+
+unsigned int CommitGraph::parentCount(uint32_t pos) const {
+    const uint8_t *data = pImpl->commitData(pos) + GIT_OID_RAWSZ;
+    uint32_t first = readBigEndian32(data);
+    uint32_t second = readBigEndian32(data + 4);
+
+    if(first == GRAPH_PARENT_NONE) {
+        return 0;
+    } else if(second == GRAPH_PARENT_NONE) {
+        return 1;
+    } else if(!(second & GRAPH_EXTRA_EDGES)) {
+        return 2;
+    }
+
+    // octopus merge: the edge list ends at the entry with the high bit set
+    unsigned int count = 1;
+    for(size_t i = second & GRAPH_EDGE_MASK; ; ++i) {
+        ++count;
+        if(pImpl->edge(pos, i) & GRAPH_EXTRA_EDGES) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+uint32_t CommitGraph::parent(uint32_t pos, unsigned int index) const {
+    const uint8_t *data = pImpl->commitData(pos) + GIT_OID_RAWSZ;
+    uint32_t second;
+
+    if(index == 0) {
+        return readBigEndian32(data);
+    }
+
+    second = readBigEndian32(data + 4);
+    if(!(second & GRAPH_EXTRA_EDGES)) {
+        return second;
+    }
+
+    return pImpl->edge(pos, (second & GRAPH_EDGE_MASK) + index - 1) & GRAPH_EDGE_MASK;
+}
+
+}
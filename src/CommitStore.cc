@@ -0,0 +1,90 @@
+
+#include "CommitStore.hh"
+#include "AuthorTable.hh"
+#include "util.hh"
+#include <git2/commit.h>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+const int SHARD_COUNT = 64;
+
+struct CommitShard {
+    mutex shardMutex;
+    unordered_map<git_oid, CommitInfo, OidHash, OidEqual> commits;
+};
+
+}
+
+class CommitStoreImpl {
+public:
+    CommitShard shards[SHARD_COUNT];
+    atomic_int size;
+
+    CommitStoreImpl() : size(0) {
+    }
+
+    bool lookup(git_repository *repo, const git_oid *id, CommitInfo& info) {
+        CommitShard& shard = shards[id->id[GIT_OID_RAWSZ - 1] % SHARD_COUNT];
+
+        {
+            unique_lock<mutex> lock(shard.shardMutex);
+            auto it = shard.commits.find(*id);
+            if(it != shard.commits.end()) {
+                info = it->second;
+                return true;
+            }
+        }
+
+        // parse outside of the shard lock, racing threads will produce the
+        // same result
+        git_commit *commit;
+        const git_signature *sig;
+
+        if(git_commit_lookup(&commit, repo, id)) {
+            return false;
+        }
+
+        sig = git_commit_committer(commit);
+        info.timestamp = git_commit_time(commit);
+        info.author = sig ? AuthorTable::get().intern(sig->email, sig->name)
+                          : AuthorTable::NO_AUTHOR;
+
+        git_commit_free(commit);
+
+        unique_lock<mutex> lock(shard.shardMutex);
+        if(shard.commits.insert(make_pair(*id, info)).second) {
+            ++size;
+        }
+
+        return true;
+    }
+};
+
+CommitStore& CommitStore::get() {
+    static CommitStore store;
+    return store;
+}
+
+CommitStore::CommitStore() : pImpl(new CommitStoreImpl) {
+}
+
+CommitStore::~CommitStore() {
+    delete pImpl;
+}
+
+bool CommitStore::lookup(git_repository *repo, const git_oid *id, CommitInfo& info) {
+    return pImpl->lookup(repo, id, info);
+}
+
+int CommitStore::size() const {
+    return pImpl->size.load();
+}
+
+}
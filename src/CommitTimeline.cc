@@ -29,12 +29,22 @@
 #include "CommitTimeline.hh"
 #include "GitStockLog.hh"
 #include "util.hh"
-#include <set>
-#include <unordered_map>
+#include "CommitGraph.hh"
+#include "Options.hh"
+#include <git2/revwalk.h>
+#include <git2/diff.h>
+#include <git2/object.h>
+#include <git2/tag.h>
+#include <git2/odb.h>
 #include <algorithm>
+#include <functional>
 #include <iostream>
-#include <list>
-#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <unordered_map>
+#include <stdexcept>
+#include <string.h>
 
 
 using namespace std;
@@ -43,103 +53,481 @@ namespace gitstock {
 
 static GitStockLog logger = GitStockLog::getLogger();
 
-struct TimelineBuilder {
-    set<string> knownCommits;
-    set<int64_t> days;
-    unordered_map<int64_t, vector<git_commit*>> commitDays;
+namespace {
+
+struct TimelineCommit {
+    git_oid id;
+    int64_t time;
+};
+
+struct DayCostSorter {
+    const vector<size_t>& costs;
+
+    DayCostSorter(const vector<size_t>& costs) : costs(costs) {
+    }
+
+    bool operator() (size_t i, size_t j) const {
+        return costs[i] > costs[j];
+    }
+};
+
+struct TimelineCommitSorter {
+    bool operator() (const TimelineCommit& left, const TimelineCommit& right) const {
+        if(left.time != right.time) {
+            return left.time < right.time;
+        }
+
+        return git_oid_cmp(&left.id, &right.id) < 0;
+    }
+};
+
+const int64_t SECONDS_PER_DAY = 86400;
+const int64_t ADAPTIVE_DAILY_SECONDS = 31 * SECONDS_PER_DAY;
+const int64_t ADAPTIVE_WEEKLY_SECONDS = 365 * SECONDS_PER_DAY;
+
+typedef unordered_set<git_oid, OidHash, OidEqual> OidSet;
+
+int tagCallback(const char *name, git_oid *id, void *payload) {
+    pair<git_repository*, OidSet*> *tags = (pair<git_repository*, OidSet*>*)payload;
+    git_object *obj;
+    git_object *commit;
+
+    // annotated tags are peeled to the commit they point to
+    if(!git_object_lookup(&obj, tags->first, id, GIT_OBJ_ANY)) {
+        if(!git_object_peel(&commit, obj, GIT_OBJ_COMMIT)) {
+            tags->second->insert(*git_object_id(commit));
+            git_object_free(commit);
+        }
+
+        git_object_free(obj);
+    }
+
+    return 0;
+}
+
+//
+// Committer time of a raw commit object, the number after the committer's
+// email. Returns false if the headers end without one.
+//
+bool readCommitTime(const char *data, size_t size, int64_t& time) {
+    const char *end = data + size;
+    const char *line = data;
+
+    // the headers end at the first empty line
+    while(line < end && *line != '\n') {
+        const char *eol = (const char*)memchr(line, '\n', end - line);
+        if(!eol) {
+            eol = end;
+        }
+
+        if(eol - line > 10 && !memcmp(line, "committer ", 10)) {
+            const char *p = eol;
+            bool negative = false;
+
+            while(p > line && p[-1] != '>') {
+                --p;
+            }
+            while(p < eol && *p == ' ') {
+                ++p;
+            }
+            if(p < eol && *p == '-') {
+                negative = true;
+                ++p;
+            }
+            if(p == eol || *p < '0' || *p > '9') {
+                return false;
+            }
+
+            time = 0;
+            while(p < eol && *p >= '0' && *p <= '9') {
+                time = time * 10 + (*p++ - '0');
+            }
+            if(negative) {
+                time = -time;
+            }
+            return true;
+        }
+
+        line = eol + 1;
+    }
+
+    return false;
+}
+
+// a commit still to be visited; pos is its commit-graph position, if any
+struct PendingCommit {
+    git_oid id;
+    uint32_t pos;
 };
 
+}
+
 class CommitTimelineImpl {
 public:
-    //set<string> known;
-    //unordered_map<int64_t, vector<git_commit*>> builder;
+    // every reachable commit, oldest first, as parallel arrays that the days
+    // point into
+    vector<git_oid> ids;
+    vector<int64_t> times;
     vector<CommitDay*> timeline;
-    list<CommitDay*> activeDays;
+    // indexes into timeline in the order pop() hands the days out
+    vector<size_t> order;
+    git_repository *repo;
     int commits;
-    mutex timelineMutex;
-    int popIndex;
-    int releaseIndex;
+    atomic<size_t> popIndex;
 
-    CommitTimelineImpl(git_commit *head) : commits(0), popIndex(0), releaseIndex(0) {
-        TimelineBuilder builder;
-        addCommit(head, builder);
-        build(builder);
+    CommitTimelineImpl(git_commit *head)
+        : repo(git_commit_owner(head)), commits(0), popIndex(0) {
+        vector<TimelineCommit> history;
+        CommitGraph graph(repo);
+
+        if(graph.loaded()) {
+            walkGraph(repo, head, graph, history);
+        } else {
+            walk(repo, head, history);
+        }
+
+        build(repo, history);
     }
 
     ~CommitTimelineImpl() {
-
+        for(CommitDay *day : timeline) {
+            delete day;
+        }
     }
 
-    void addCommit(git_commit *commit, TimelineBuilder& builder) {
-        string id((const char*)git_commit_id(commit)->id, 20);
-        auto result = builder.knownCommits.insert(id);
-        if(result.second) {
-            int64_t day = getDayTimestamp(commit);
-            unsigned int parents = git_commit_parentcount(commit);
+    //
+    // Collect every commit reachable from head. The revwalk is iterative and
+    // tracks visited commits itself, so long histories need neither deep
+    // recursion nor a set of known ids here.
+    //
+    // The revwalk doesn't hand out the commit times it has read, and the odb
+    // header of an object only has its type and size, so without a
+    // commit-graph every commit is read once more. Only the committer time
+    // is scanned from the raw object instead of parsing all of the commit.
+    //
+    void walk(git_repository *repo, git_commit *head, vector<TimelineCommit>& history) {
+        git_revwalk *walker;
+        git_odb *odb;
+        TimelineCommit entry;
+
+        if(git_repository_odb(&odb, repo)) {
+            throw runtime_error("failed to open the object database");
+        }
+
+        if(git_revwalk_new(&walker, repo) || git_revwalk_push(walker, git_commit_id(head))) {
+            git_odb_free(odb);
+            throw runtime_error("failed to walk history");
+        }
+
+        while(!git_revwalk_next(&entry.id, walker)) {
+            git_odb_object *object;
 
-            ++commits;
+            if(git_odb_read(&object, odb, &entry.id)) {
+                continue;
+            }
 
-            builder.commitDays[day].push_back(commit);
-            builder.days.insert(day);
+            bool found = readCommitTime((const char*)git_odb_object_data(object),
+                                        git_odb_object_size(object), entry.time);
+            git_odb_object_free(object);
 
-            for(unsigned int index = 0; index < parents; ++index) {
-                git_commit *parent;
-                git_commit_parent(&parent, commit, index);
+            if(!found) {
+                git_commit *commit;
 
-                addCommit(parent, builder);
+                if(git_commit_lookup(&commit, repo, &entry.id)) {
+                    continue;
+                }
+                entry.time = git_commit_time(commit);
+                git_commit_free(commit);
             }
+
+            history.push_back(entry);
         }
+
+        git_revwalk_free(walker);
+        git_odb_free(odb);
     }
 
-    void build(TimelineBuilder& builder) {
-        int totalCount = 0;
-        for(int64_t timestamp : builder.days) {
-            vector<git_commit*>& commits = builder.commitDays[timestamp];
-            CommitDay *day = new CommitDay(timestamp, commits);
+    //
+    // Same as walk(), but parents and commit times come straight from the
+    // commit-graph. Only commits the graph doesn't cover, typically the ones
+    // made since it was last written, are parsed.
+    //
+    void walkGraph(git_repository *repo, git_commit *head, const CommitGraph& graph,
+                   vector<TimelineCommit>& history) {
+        vector<bool> visited(graph.commitCount(), false);
+        unordered_set<git_oid, OidHash, OidEqual> parsed;
+        vector<PendingCommit> pending;
+        PendingCommit next;
+        TimelineCommit entry;
+        size_t fromGraph = 0;
+
+        next.id = *git_commit_id(head);
+        next.pos = graph.find(&next.id);
+        pending.push_back(next);
+
+        while(!pending.empty()) {
+            PendingCommit current = pending.back();
+            pending.pop_back();
+
+            if(current.pos != CommitGraph::NO_POSITION) {
+                if(current.pos >= visited.size() || visited[current.pos]) {
+                    continue;
+                }
+
+                visited[current.pos] = true;
+                entry.id = *graph.id(current.pos);
+                entry.time = graph.commitTime(current.pos);
+                history.push_back(entry);
+                ++fromGraph;
+
+                unsigned int parents = graph.parentCount(current.pos);
+                for(unsigned int i = 0; i < parents; ++i) {
+                    next.pos = graph.parent(current.pos, i);
+                    pending.push_back(next);
+                }
+            } else if(parsed.insert(current.id).second) {
+                git_commit *commit;
+
+                if(git_commit_lookup(&commit, repo, &current.id)) {
+                    continue;
+                }
+
+                entry.id = current.id;
+                entry.time = git_commit_time(commit);
+                history.push_back(entry);
+
+                unsigned int parents = git_commit_parentcount(commit);
+                for(unsigned int i = 0; i < parents; ++i) {
+                    next.id = *git_commit_parent_id(commit, i);
+                    next.pos = graph.find(&next.id);
+                    pending.push_back(next);
+                }
+
+                git_commit_free(commit);
+            }
+        }
 
-            totalCount += commits.size();
-            day->totalCommitCount(totalCount);
+        logger.debug() << "commit-graph: " << fromGraph << " of " << history.size()
+            << " commits" << endlog;
+    }
 
-            timeline.push_back(day);
+    void build(git_repository *repo, vector<TimelineCommit>& history) {
+        sort(history.begin(), history.end(), TimelineCommitSorter());
+
+        commits = history.size();
+        ids.resize(history.size());
+        times.resize(history.size());
+        for(size_t i = 0; i < history.size(); ++i) {
+            ids[i] = history[i].id;
+            times[i] = history[i].time;
+        }
+
+        OidSet tags;
+        if(Options.granularity == GRANULARITY_TAG) {
+            pair<git_repository*, OidSet*> payload(repo, &tags);
+            git_tag_foreach(repo, tagCallback, &payload);
+        }
+
+        int64_t newest = times.empty() ? 0 : times.back();
+        size_t start = 0;
+        for(size_t i = 0; i < history.size(); ++i) {
+            bool last = i + 1 == history.size();
+
+            if(!last) {
+                switch(Options.granularity) {
+                case GRANULARITY_COMMIT:
+                    last = true;
+                    break;
+                case GRANULARITY_TAG:
+                    last = tags.count(ids[i]) > 0;
+                    break;
+                default:
+                    last = bucketTimestamp(times[i], newest) != bucketTimestamp(times[i + 1], newest);
+                    break;
+                }
+            }
 
-            commits.clear();
+            if(last) {
+                addDay(repo, start, i + 1, bucketTimestamp(times[i], newest));
+                start = i + 1;
+            }
         }
 
-        // We process the days in reverse order. This way we don't run into
-        // problems when performing git blame which references a previously
-        // cached commit
+        // newest first, which is also the default processing order
         reverse(timeline.begin(), timeline.end());
+        for(size_t i = 0; i < timeline.size(); ++i) {
+            order.push_back(i);
+        }
     }
 
-    CommitDay* pop() {
-        unique_lock<mutex> lock(timelineMutex);
-        CommitDay *day;
-        if(popIndex < timeline.size()) {
-            day = timeline[popIndex];
-            ++popIndex;
+    //
+    // Order the days by their estimated cost, most expensive first, so that
+    // the run doesn't end with one thread working through a huge day while
+    // the others are idle. Unchanged files are served from the blame cache,
+    // so a day costs roughly the number of files changed since the previous
+    // snapshot, but only while the cache still has the previous versions:
+    // it keeps a few per path, so days are only reordered within windows of
+    // that many consecutive days, and the windows go newest first. The
+    // paths noted by findChanges() give the estimates; without them each
+    // takes a tree diff, so they are computed on threads.
+    //
+    void schedule(int threads, size_t window) {
+        vector<size_t> costs(timeline.size(), 0);
+
+        forEachDay(threads, [this, &costs](size_t i) {
+            // the previous snapshot follows in the newest first timeline
+            costs[i] = estimateCost(timeline[i], i + 1 < timeline.size() ? timeline[i + 1] : nullptr);
+        });
+
+        window = max<size_t>(window, 1);
+        for(size_t start = 0; start < order.size(); start += window) {
+            size_t end = min(start + window, order.size());
+            stable_sort(order.begin() + start, order.begin() + end, DayCostSorter(costs));
+        }
+    }
 
-            //cout << "Processing day: " << day->date() << " (" << day->commits().size() << ")\n";
-        } else {
-            day = nullptr;
+    void scheduleOldestFirst() {
+        // timeline is newest first
+        sort(order.begin(), order.end(), greater<size_t>());
+    }
+
+    void shard(size_t index, size_t count) {
+        vector<size_t> kept;
+
+        for(size_t i : order) {
+            if(timeline[i]->sequence() % count == index) {
+                kept.push_back(i);
+            }
         }
 
-        return day;
+        order.swap(kept);
     }
 
-    void release(CommitDay *day) {
-        unique_lock<mutex> lock(timelineMutex);
-        day->release();
-        for(; releaseIndex < timeline.size(); ++releaseIndex) {
-            CommitDay *cd = timeline[releaseIndex];
-            if(cd->isPendingRelease()) {
-                //logger.debug() << "releasing commit day " << cd->date() << endlog;
-                timeline[releaseIndex] = nullptr;
-                delete cd;
-            } else {
-                break;
+    void skip(const function<bool(const CommitDay*)>& done) {
+        vector<size_t> kept;
+
+        for(size_t i : order) {
+            if(!done(timeline[i])) {
+                kept.push_back(i);
+            }
+        }
+
+        order.swap(kept);
+    }
+
+    void findChanges(int threads) {
+        forEachDay(threads, [this](size_t i) {
+            timeline[i]->findChanges(nullptr);
+        });
+    }
+
+    bool unchanged(size_t sequence, const string& path) const {
+        // newest first
+        return sequence < timeline.size() && timeline[timeline.size() - 1 - sequence]->unchanged(path);
+    }
+
+    // run work(i) for every day i of the timeline on threads
+    void forEachDay(int threads, const function<void(size_t)>& work) {
+        vector<thread> pool;
+        atomic<size_t> next(0);
+        auto worker = [this, &work, &next]() {
+            size_t i;
+
+            while((i = next++) < timeline.size()) {
+                work(i);
+            }
+        };
+
+        for(int i = 1; i < threads; ++i) {
+            pool.push_back(thread(worker));
+        }
+
+        worker();
+
+        for(thread& t : pool) {
+            t.join();
+        }
+    }
+
+    size_t estimateCost(const CommitDay *day, const CommitDay *previous) {
+        // known when findChanges() ran first
+        if(day->changeCount() >= 0) {
+            return 1 + day->changeCount();
+        }
+
+        git_tree *tree = loadTree(day);
+        git_tree *previousTree = previous ? loadTree(previous) : nullptr;
+        git_diff *diff;
+        // every snapshot pays for the tree walk and its report
+        size_t cost = 1;
+
+        if(tree && !git_diff_tree_to_tree(&diff, repo, previousTree, tree, nullptr)) {
+            cost += git_diff_num_deltas(diff);
+            git_diff_free(diff);
+        }
+
+        git_tree_free(previousTree);
+        git_tree_free(tree);
+
+        return cost;
+    }
+
+    git_tree* loadTree(const CommitDay *day) {
+        git_commit *commit;
+        git_tree *tree = nullptr;
+
+        if(!git_commit_lookup(&commit, repo, day->lastCommitId())) {
+            git_commit_tree(&tree, commit);
+            git_commit_free(commit);
+        }
+
+        return tree;
+    }
+
+    void addDay(git_repository *repo, size_t start, size_t end, int64_t timestamp) {
+        CommitDay *day = new CommitDay(repo, timestamp, &ids[start], &times[start], end - start);
+
+        day->totalCommitCount(end);
+        day->sequence(timeline.size());
+        day->previousCommitId(start ? &ids[start - 1] : nullptr);
+        timeline.push_back(day);
+    }
+
+    //
+    // Start of the snapshot bucket containing a commit made at time. Commit
+    // and tag snapshots are timestamped with their last commit.
+    //
+    int64_t bucketTimestamp(int64_t time, int64_t newest) const {
+        int64_t age = newest - time;
+
+        switch(Options.granularity) {
+        case GRANULARITY_DAY:
+            return getDayTimestamp(time);
+        case GRANULARITY_WEEK:
+            return getWeekTimestamp(time);
+        case GRANULARITY_MONTH:
+            return getMonthTimestamp(time);
+        case GRANULARITY_ADAPTIVE:
+            if(age < ADAPTIVE_DAILY_SECONDS) {
+                return getDayTimestamp(time);
+            } else if(age < ADAPTIVE_WEEKLY_SECONDS) {
+                return getWeekTimestamp(time);
             }
+            return getMonthTimestamp(time);
+        default:
+            return time;
         }
     }
+
+    CommitDay* pop() {
+        size_t i = popIndex++;
+        return i < order.size() ? timeline[order[i]] : nullptr;
+    }
+
+    void release(CommitDay *day) {
+        // the day itself is a few pointers; only its commits are worth freeing
+        day->release();
+    }
 };
 
 
@@ -167,6 +555,34 @@ std::vector< CommitDay* >::const_iterator CommitTimeline::end() const {
     return pImpl->timeline.end();
 }
 
+void CommitTimeline::findChanges(int threads) {
+    pImpl->findChanges(threads);
+}
+
+bool CommitTimeline::unchanged(size_t sequence, const string& path) const {
+    return pImpl->unchanged(sequence, path);
+}
+
+void CommitTimeline::schedule(int threads, size_t window) {
+    pImpl->schedule(threads, window);
+}
+
+void CommitTimeline::scheduleOldestFirst() {
+    pImpl->scheduleOldestFirst();
+}
+
+void CommitTimeline::shard(size_t index, size_t count) {
+    pImpl->shard(index, count);
+}
+
+void CommitTimeline::skip(const function<bool(const CommitDay*)>& done) {
+    pImpl->skip(done);
+}
+
+int CommitTimeline::scheduledDays() const {
+    return pImpl->order.size();
+}
+
 CommitDay* CommitTimeline::pop() {
     return pImpl->pop();
 }
@@ -177,32 +593,156 @@ void CommitTimeline::release(CommitDay* day) {
 
 
 
-bool compareCommits(const git_commit *left, const git_commit *right) {
-    return git_commit_time(left) < git_commit_time(right);
-}
-
 class CommitDayImpl {
 public:
+    git_repository *repo;
     int64_t timestamp;
+    // owned by the timeline, sorted by commit time
+    const git_oid *ids;
+    const int64_t *times;
+    size_t count;
+    const git_oid *previous;
     vector<git_commit*> commits;
-    bool isPendingRelease;
+    // hashes of the paths changed since the previous snapshot, sorted
+    vector<size_t> changed;
+    bool changesKnown;
     int totalCommitCount;
+    size_t sequence;
 
-    CommitDayImpl(int64_t timestamp, const vector<git_commit*>& commits)
-        : timestamp(timestamp), commits(commits), isPendingRelease(false),
-        totalCommitCount(0) {
-        sort(this->commits.begin(), this->commits.end(), compareCommits);
+    CommitDayImpl(git_repository *repo, int64_t timestamp, const git_oid *ids,
+                  const int64_t *times, size_t count)
+        : repo(repo), timestamp(timestamp), ids(ids), times(times), count(count),
+        previous(nullptr), changesKnown(false), totalCommitCount(0), sequence(0) {
     }
 
     ~CommitDayImpl() {
+        release();
+    }
+
+    bool load(git_repository *repo) {
+        if(!commits.empty()) {
+            return true;
+        }
+
+        if(!repo) {
+            repo = this->repo;
+        }
+
+        commits.reserve(count);
+        for(size_t i = 0; i < count; ++i) {
+            git_commit *commit;
+
+            if(git_commit_lookup(&commit, repo, &ids[i])) {
+                release();
+                return false;
+            }
+
+            commits.push_back(commit);
+        }
+
+        return true;
+    }
+
+    void release() {
         for(git_commit *commit : commits) {
             git_commit_free(commit);
         }
+
+        commits.clear();
+        commits.shrink_to_fit();
+    }
+
+    void findChanges(git_repository *repo) {
+        bool loaded = !commits.empty();
+        unordered_set<string> paths;
+
+        changed.clear();
+        changesKnown = previous && load(repo) && changedPaths(paths);
+        if(!loaded) {
+            release();
+        }
+
+        if(!changesKnown) {
+            return;
+        }
+
+        // a colliding hash only costs a cache miss
+        for(const string& path : paths) {
+            changed.push_back(hash<string>()(path));
+        }
+        sort(changed.begin(), changed.end());
+        changed.shrink_to_fit();
+    }
+
+    bool unchanged(const string& path) const {
+        return changesKnown && !binary_search(changed.begin(), changed.end(), hash<string>()(path));
+    }
+
+    //
+    // Walk the first-parent chain from the last commit back to the previous
+    // snapshot, collecting the paths each commit changed. Returns false if
+    // the chain leaves the day's commits without reaching it.
+    //
+    bool changedPaths(unordered_set<string>& paths) const {
+        unordered_map<git_oid, git_commit*, OidHash, OidEqual> loaded;
+
+        for(git_commit *commit : commits) {
+            loaded[*git_commit_id(commit)] = commit;
+        }
+
+        const git_commit *current = commits.back();
+        while(true) {
+            if(!git_commit_parentcount(current) || !diffFirstParent(current, paths)) {
+                return false;
+            }
+
+            const git_oid *parent = git_commit_parent_id(current, 0);
+            if(git_oid_equal(parent, previous)) {
+                return true;
+            }
+
+            auto it = loaded.find(*parent);
+            if(it == loaded.end()) {
+                return false;
+            }
+            current = it->second;
+        }
+    }
+
+    static bool diffFirstParent(const git_commit *commit, unordered_set<string>& paths) {
+        git_commit *parent;
+        git_tree *tree = nullptr;
+        git_tree *parentTree = nullptr;
+        git_diff *diff;
+        bool ok = false;
+
+        if(git_commit_parent(&parent, commit, 0)) {
+            return false;
+        }
+
+        if(!git_commit_tree(&tree, commit) && !git_commit_tree(&parentTree, parent) &&
+           !git_diff_tree_to_tree(&diff, git_commit_owner(commit), parentTree, tree, nullptr)) {
+            for(size_t i = 0; i < git_diff_num_deltas(diff); ++i) {
+                const git_diff_delta *delta = git_diff_get_delta(diff, i);
+                paths.insert(delta->old_file.path);
+                paths.insert(delta->new_file.path);
+            }
+
+            git_diff_free(diff);
+            ok = true;
+        }
+
+        git_tree_free(parentTree);
+        git_tree_free(tree);
+        git_commit_free(parent);
+
+        return ok;
     }
 };
 
-CommitDay::CommitDay(int64_t timestamp, const std::vector< git_commit* >& commits)
-    : pImpl(new CommitDayImpl(timestamp, commits)) {
+CommitDay::CommitDay(git_repository *repo, int64_t timestamp, const git_oid *ids,
+                     const int64_t *times, size_t count)
+    : pImpl(new CommitDayImpl(repo, timestamp, ids, times, count)) {
 }
 
 CommitDay::~CommitDay() {
@@ -217,6 +757,22 @@ int64_t CommitDay::timestamp() const {
     return pImpl->timestamp;
 }
 
+size_t CommitDay::commitCount() const {
+    return pImpl->count;
+}
+
+const git_oid* CommitDay::lastCommitId() const {
+    return &pImpl->ids[pImpl->count - 1];
+}
+
+const git_oid* CommitDay::previousCommitId() const {
+    return pImpl->previous;
+}
+
+void CommitDay::previousCommitId(const git_oid *id) {
+    pImpl->previous = id;
+}
+
 std::vector< git_commit* >::const_iterator CommitDay::begin() const {
     return pImpl->commits.begin();
 }
@@ -227,23 +783,41 @@ std::vector< git_commit* >::const_iterator CommitDay::end() const {
 
 string CommitDay::date() const {
     char buff[64];
-    strftime(buff, 64, "%A %B %d, %Y", localtime(&pImpl->timestamp));
+    tm date;
+    strftime(buff, 64, "%A %B %d, %Y", localtime_r(&pImpl->timestamp, &date));
     return buff;
 }
 
 string CommitDay::shortDay() const {
     char buff[64];
-    strftime(buff, 64, "%F", localtime(&pImpl->timestamp));
+    tm date;
+    strftime(buff, 64, "%F", localtime_r(&pImpl->timestamp, &date));
     return buff;
 }
 
 
-bool CommitDay::isPendingRelease() const {
-    return pImpl->isPendingRelease;
+bool CommitDay::load() {
+    return pImpl->load(pImpl->repo);
+}
+
+bool CommitDay::load(git_repository *repo) {
+    return pImpl->load(repo);
 }
 
 void CommitDay::release() {
-    pImpl->isPendingRelease = true;
+    pImpl->release();
+}
+
+void CommitDay::findChanges(git_repository *repo) {
+    pImpl->findChanges(repo);
+}
+
+bool CommitDay::unchanged(const string& path) const {
+    return pImpl->unchanged(path);
+}
+
+int CommitDay::changeCount() const {
+    return pImpl->changesKnown ? (int)pImpl->changed.size() : -1;
 }
 
 int CommitDay::totalCommitCount() const {
@@ -254,22 +828,30 @@ void CommitDay::totalCommitCount(int count) {
     pImpl->totalCommitCount = count;
 }
 
+size_t CommitDay::sequence() const {
+    return pImpl->sequence;
+}
+
+void CommitDay::sequence(size_t sequence) {
+    pImpl->sequence = sequence;
+}
+
+double CommitDay::commitSpanHours() const {
+    if(pImpl->count > 1) {
+        return (pImpl->times[pImpl->count - 1] - pImpl->times[0]) / 3600.0;
+    }
+
+    return 0.0;
+}
+
 Json::Value CommitDay::toJson() const {
     Json::Value json(Json::objectValue);
-    double commitWindow;
 
     json["_type"] = "commit-day";
     json["Timestamp"] = (Json::Int64)pImpl->timestamp;
-    json["CommitCount"] = (Json::Int)pImpl->commits.size();
+    json["CommitCount"] = (Json::Int)pImpl->count;
     json["TotalCommitCount"] = pImpl->totalCommitCount;
-
-    if(pImpl->commits.size() > 1) {
-        commitWindow = (git_commit_time(pImpl->commits.back()) -
-                        git_commit_time(pImpl->commits.front())) / 3600.0;
-    } else {
-        commitWindow = 0.0;
-    }
-    json["CommitSpanHours"] = commitWindow;
+    json["CommitSpanHours"] = commitSpanHours();
 
 
     return json;
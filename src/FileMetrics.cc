@@ -2,6 +2,8 @@
 #include "FileMetrics.hh"
 #include "util.hh"
 #include "Stock.hh"
+#include "CommitStore.hh"
+#include "AuthorTable.hh"
 #include <git2/blame.h>
 #include <ctime>
 
@@ -22,7 +24,6 @@ public:
 
         git_repository *repo = git_tree_owner(tree);
         git_blame *blame;
-        git_commit *commit;
 		uint32_t hunkCount;
         int rc;
 	git_blame_options opts = GIT_BLAME_OPTIONS_INIT;
@@ -50,21 +51,42 @@ public:
         git_blame_free(blame);
     }
 
-    void addHunk(git_repository *repo, const git_blame_hunk *hunk) {
-        git_commit *commit;
-        const git_signature *sig;
-        time_t now = time(nullptr);
+    FileMetricsImpl(LineAgeMetrics& lineMetrics, const string& path, const LineOrigins& origins)
+        : lineMetrics(lineMetrics), path(path) {
+        size_t start = 0;
+
+        // consecutive lines from the same commit form a block, like a hunk
+        for(size_t i = 1; i <= origins.size(); ++i) {
+            if(i == origins.size() || origins[i].timestamp != origins[start].timestamp
+               || origins[i].author != origins[start].author) {
+                addLineBlock(origins[start].timestamp, origins[start].author, i - start);
+                start = i;
+            }
+        }
 
-        git_commit_lookup(&commit, repo, &hunk->final_commit_id);
-        sig = git_commit_committer(commit);
+        stocks.sort();
+    }
 
-		lineMetrics.addLineBlock(git_commit_time(commit), hunk->lines_in_hunk);
+    FileMetricsImpl(LineAgeMetrics& lineMetrics, const FileMetricsImpl& other)
+        : lineMetrics(lineMetrics), path(other.path), stocks(other.stocks) {
+    }
 
-        if(sig) {
-            stocks.find(sig).addLineBlock(git_commit_time(commit), hunk->lines_in_hunk);
+    void addHunk(git_repository *repo, const git_blame_hunk *hunk) {
+        CommitInfo info;
+
+        if(!CommitStore::get().lookup(repo, &hunk->final_commit_id, info)) {
+            return;
         }
 
-        git_commit_free(commit);
+        addLineBlock(info.timestamp, info.author, hunk->lines_in_hunk);
+    }
+
+    void addLineBlock(int64_t timestamp, uint32_t author, int lines) {
+		lineMetrics.addLineBlock(timestamp, lines);
+
+        if(author != AuthorTable::NO_AUTHOR) {
+            stocks.find(author).addLineBlock(timestamp, lines);
+        }
     }
 };
 
@@ -74,10 +96,31 @@ FileMetrics::FileMetrics(const git_tree *tree, const string& path,
 
 }
 
+FileMetrics::FileMetrics(const string& path, const LineOrigins& origins)
+    : LineAgeMetrics(), pImpl(new FileMetricsImpl(*this, path, origins)) {
+
+}
+
+FileMetrics::FileMetrics(const FileMetrics& other)
+    : LineAgeMetrics(other), pImpl(new FileMetricsImpl(*this, *other.pImpl)) {
+
+}
+
 FileMetrics::~FileMetrics() {
     delete pImpl;
 }
 
+FileMetrics& FileMetrics::operator=(const FileMetrics& other) {
+    if(this != &other) {
+        LineAgeMetrics::operator=(other);
+        // lineMetrics keeps referring to this
+        pImpl->path = other.pImpl->path;
+        pImpl->stocks = other.pImpl->stocks;
+    }
+
+    return *this;
+}
+
 const string& FileMetrics::path() const {
 	return pImpl->path;
 }
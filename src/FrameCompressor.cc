@@ -0,0 +1,314 @@
+
+#include "FrameCompressor.hh"
+#include "GitStockLog.hh"
+#include <vector>
+#include <utility>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef GITSTOCK_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace gitstock {
+
+static GitStockLog logger = GitStockLog::getLogger();
+
+namespace {
+
+// fixed gzip member header with an FEXTRA field holding one "GS" subfield,
+// whose four bytes are the length of the whole member
+const unsigned char GZIP_HEADER[] = {
+    0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff,
+    8, 0,
+    'G', 'S', 4, 0
+};
+const size_t GZIP_HEADER_SIZE = sizeof(GZIP_HEADER) + 4;
+// CRC-32 and size of the uncompressed data
+const size_t GZIP_TRAILER_SIZE = 8;
+
+const uint32_t ZSTD_SKIPPABLE_MAGIC = 0x184d2a5e;
+const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8f92eab1;
+
+void putLE32(char *p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+void appendLE32(string& buffer, uint32_t value) {
+    char bytes[4];
+
+    putLE32(bytes, value);
+    buffer.append(bytes, sizeof(bytes));
+}
+
+uint32_t getLE32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// deflate state of a thread, reset between frames
+struct Deflater {
+    z_stream stream;
+    bool ready;
+
+    Deflater() : ready(false) {
+    }
+
+    ~Deflater() {
+        if(ready) {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+thread_local Deflater deflater;
+
+#ifdef GITSTOCK_HAVE_ZSTD
+struct ZstdContext {
+    ZSTD_CCtx *context;
+
+    ZstdContext() : context(ZSTD_createCCtx()) {
+    }
+
+    ~ZstdContext() {
+        ZSTD_freeCCtx(context);
+    }
+};
+
+thread_local ZstdContext zstdContext;
+#endif
+
+}
+
+class FrameCompressorImpl {
+public:
+    Compression compression;
+    // uncompressed and compressed size of every zstd frame
+    vector<pair<uint32_t, uint32_t>> frames;
+
+    FrameCompressorImpl(Compression compression) : compression(compression) {
+    }
+
+    bool compressGzip(const char *data, size_t size, string& frame) const {
+        z_stream& stream = deflater.stream;
+        size_t start = frame.size();
+        size_t bound;
+        char *member;
+
+        if(!deflater.ready) {
+            memset(&stream, 0, sizeof(stream));
+            if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                            Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            deflater.ready = true;
+        } else {
+            deflateReset(&stream);
+        }
+
+        // frames are far below the 4 GB that zlib's counts can hold
+        bound = deflateBound(&stream, size);
+        frame.resize(start + GZIP_HEADER_SIZE + bound + GZIP_TRAILER_SIZE);
+        member = &frame[start];
+        memcpy(member, GZIP_HEADER, sizeof(GZIP_HEADER));
+
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef*)member + GZIP_HEADER_SIZE;
+        stream.avail_out = bound;
+
+        if(deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+            frame.resize(start);
+            return false;
+        }
+
+        size_t length = GZIP_HEADER_SIZE + stream.total_out + GZIP_TRAILER_SIZE;
+        char *trailer = member + GZIP_HEADER_SIZE + stream.total_out;
+
+        putLE32(member + sizeof(GZIP_HEADER), length);
+        putLE32(trailer, crc32(crc32(0, Z_NULL, 0), (const Bytef*)data, size));
+        putLE32(trailer + 4, size);
+        frame.resize(start + length);
+
+        return true;
+    }
+
+    bool compressZstd(const char *data, size_t size, string& frame) const {
+#ifdef GITSTOCK_HAVE_ZSTD
+        size_t start = frame.size();
+        size_t bound = ZSTD_compressBound(size);
+
+        frame.resize(start + bound);
+
+        // the frame header records the uncompressed size
+        size_t length = ZSTD_compressCCtx(zstdContext.context, &frame[start], bound, data,
+                                          size, ZSTD_CLEVEL_DEFAULT);
+        if(ZSTD_isError(length)) {
+            logger.error() << "zstd: " << ZSTD_getErrorName(length) << endlog;
+            frame.resize(start);
+            return false;
+        }
+
+        frame.resize(start + length);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //
+    // Walk the gzip members by the lengths in their headers.
+    //
+    bool scanGzip(int fd, uint64_t size) {
+        uint64_t offset = 0;
+        unsigned char header[GZIP_HEADER_SIZE];
+
+        while(offset < size) {
+            if(size - offset < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE ||
+               pread(fd, header, sizeof(header), offset) != (ssize_t)sizeof(header) ||
+               memcmp(header, GZIP_HEADER, sizeof(GZIP_HEADER))) {
+                return false;
+            }
+
+            uint32_t length = getLE32(header + sizeof(GZIP_HEADER));
+            if(length < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE || length > size - offset) {
+                return false;
+            }
+
+            offset += length;
+        }
+
+        return true;
+    }
+
+    bool scanZstd(int fd, uint64_t size) {
+#ifdef GITSTOCK_HAVE_ZSTD
+        void *data;
+        const char *p;
+        bool complete = true;
+
+        if(!size) {
+            return true;
+        }
+
+        data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+
+        p = (const char*)data;
+        while(p != (const char*)data + size) {
+            size_t left = (const char*)data + size - p;
+            size_t length = ZSTD_findFrameCompressedSize(p, left);
+            unsigned long long content = ZSTD_getFrameContentSize(p, left);
+
+            if(ZSTD_isError(length) || content == ZSTD_CONTENTSIZE_UNKNOWN ||
+               content == ZSTD_CONTENTSIZE_ERROR) {
+                complete = false;
+                break;
+            }
+
+            frames.push_back(make_pair((uint32_t)content, (uint32_t)length));
+            p += length;
+        }
+
+        munmap(data, size);
+        return complete;
+#else
+        return false;
+#endif
+    }
+
+    //
+    // The seek table is a skippable frame of (compressed size, uncompressed
+    // size) entries followed by a footer with the number of frames, a
+    // descriptor byte (no checksums) and the seekable format's magic number.
+    //
+    void finishZstd(string& trailer) {
+        appendLE32(trailer, ZSTD_SKIPPABLE_MAGIC);
+        appendLE32(trailer, frames.size() * 8 + 9);
+
+        for(const pair<uint32_t, uint32_t>& frame : frames) {
+            appendLE32(trailer, frame.second);
+            appendLE32(trailer, frame.first);
+        }
+
+        appendLE32(trailer, frames.size());
+        trailer += '\0';
+        appendLE32(trailer, ZSTD_SEEKABLE_MAGIC);
+    }
+};
+
+FrameCompressor::FrameCompressor(Compression compression)
+    : pImpl(new FrameCompressorImpl(compression)) {
+}
+
+FrameCompressor::~FrameCompressor() {
+    delete pImpl;
+}
+
+bool FrameCompressor::compress(const char *data, size_t size, string& frame) const {
+    switch(pImpl->compression) {
+    case COMPRESS_GZIP:
+        return pImpl->compressGzip(data, size, frame);
+    case COMPRESS_ZSTD:
+        return pImpl->compressZstd(data, size, frame);
+    default:
+        frame.append(data, size);
+        return true;
+    }
+}
+
+void FrameCompressor::written(size_t size, size_t compressedSize) {
+    if(pImpl->compression == COMPRESS_ZSTD) {
+        pImpl->frames.push_back(make_pair((uint32_t)size, (uint32_t)compressedSize));
+    }
+}
+
+bool FrameCompressor::scan(int fd, uint64_t size) {
+    switch(pImpl->compression) {
+    case COMPRESS_GZIP:
+        return pImpl->scanGzip(fd, size);
+    case COMPRESS_ZSTD:
+        return pImpl->scanZstd(fd, size);
+    default:
+        return true;
+    }
+}
+
+void FrameCompressor::finish(string& trailer) {
+    if(pImpl->compression == COMPRESS_ZSTD) {
+        pImpl->finishZstd(trailer);
+    }
+}
+
+Compression FrameCompressor::fromPath(const string& path) {
+    size_t dot = path.rfind('.');
+
+    if(dot == string::npos || path.find('/', dot) != string::npos) {
+        return COMPRESS_NONE;
+    }
+
+    if(path.compare(dot, string::npos, ".gz") == 0) {
+        return COMPRESS_GZIP;
+    } else if(path.compare(dot, string::npos, ".zst") == 0) {
+        return COMPRESS_ZSTD;
+    }
+
+    return COMPRESS_NONE;
+}
+
+bool FrameCompressor::isAvailable(Compression compression) {
+#ifdef GITSTOCK_HAVE_ZSTD
+    return true;
+#else
+    return compression != COMPRESS_ZSTD;
+#endif
+}
+
+}
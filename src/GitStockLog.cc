@@ -81,6 +81,7 @@ ostream& releaselog(ostream& os) {
 ostream& endlog(ostream& os) {
     os << "\n" << flush;
     logMutex.unlock();
+    return os;
 }
 
 
@@ -0,0 +1,199 @@
+
+#include "Journal.hh"
+#include "GitStockLog.hh"
+#include <unordered_set>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace gitstock {
+
+static GitStockLog logger = GitStockLog::getLogger();
+
+namespace {
+
+const char *JOURNAL_VERSION = "git-stock-journal 1";
+
+}
+
+class JournalImpl {
+public:
+    string outputPath;
+    string path;
+    string run;
+    unordered_set<size_t> done;
+    // complete entries read by load()
+    string entries;
+    uint64_t size;
+    int fd;
+    // entries recorded since the last sync
+    string pending;
+    uint64_t pendingSize;
+    chrono::steady_clock::time_point lastSync;
+
+    JournalImpl(const string& outputPath, const string& run)
+        : outputPath(outputPath), path(outputPath + ".journal"), run(run), size(0), fd(-1),
+        pendingSize(0), lastSync(chrono::steady_clock::now()) {
+    }
+
+    ~JournalImpl() {
+        if(fd >= 0) {
+            sync();
+            close(fd);
+        }
+    }
+
+    bool load() {
+        ifstream stream(path.c_str());
+        string line;
+
+        if(!stream.good()) {
+            return true;
+        }
+
+        if(!getline(stream, line) || line != header()) {
+            return false;
+        }
+
+        // a line without its newline was cut off mid-write and is ignored
+        while(getline(stream, line) && !stream.eof()) {
+            size_t sequence;
+            long long timestamp;
+            unsigned long long offset;
+
+            if(sscanf(line.c_str(), "%zu %lld %llu", &sequence, &timestamp, &offset) == 3) {
+                done.insert(sequence);
+                entries += line + "\n";
+                size = offset;
+            }
+        }
+
+        return true;
+    }
+
+    bool open() {
+        if(truncate(outputPath.c_str(), size)) {
+            logger.error() << "failed to truncate " << outputPath << ": " << strerror(errno) << endlog;
+            return false;
+        }
+
+        // rewrite the journal so a truncated last line can't linger
+        string contents = header() + "\n" + entries;
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || !writeAll(contents) || fsync(fd)) {
+            logger.error() << "failed to write " << path << ": " << strerror(errno) << endlog;
+            return false;
+        }
+
+        return true;
+    }
+
+    string header() const {
+        return string(JOURNAL_VERSION) + " " + run;
+    }
+
+    static string entry(size_t sequence, int64_t timestamp, uint64_t offset) {
+        ostringstream ss;
+        ss << sequence << " " << timestamp << " " << offset << "\n";
+        return ss.str();
+    }
+
+    bool writeAll(const string& data) {
+        const char *p = data.data();
+        size_t left = data.size();
+
+        while(left) {
+            ssize_t n = write(fd, p, left);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            p += n;
+            left -= n;
+        }
+
+        return true;
+    }
+
+    void record(size_t sequence, int64_t timestamp, uint64_t offset) {
+        done.insert(sequence);
+        pending += entry(sequence, timestamp, offset);
+        pendingSize = offset;
+
+        if(chrono::steady_clock::now() - lastSync >= chrono::seconds(1)) {
+            sync();
+        }
+    }
+
+    void sync() {
+        if(fd < 0 || pending.empty()) {
+            return;
+        }
+
+        // the output has to be on disk before the journal claims it is
+        int output = ::open(outputPath.c_str(), O_RDONLY);
+        if(output < 0 || fsync(output)) {
+            logger.error() << "failed to sync " << outputPath << ": " << strerror(errno) << endlog;
+        } else if(!writeAll(pending) || fsync(fd)) {
+            logger.error() << "failed to write " << path << ": " << strerror(errno) << endlog;
+        } else {
+            size = pendingSize;
+            pending.clear();
+        }
+
+        if(output >= 0) {
+            close(output);
+        }
+
+        lastSync = chrono::steady_clock::now();
+    }
+};
+
+Journal::Journal(const string& outputPath, const string& run)
+    : pImpl(new JournalImpl(outputPath, run)) {
+}
+
+Journal::~Journal() {
+    delete pImpl;
+}
+
+bool Journal::load() {
+    return pImpl->load();
+}
+
+bool Journal::open() {
+    return pImpl->open();
+}
+
+bool Journal::isDone(size_t sequence) const {
+    return pImpl->done.count(sequence) > 0;
+}
+
+size_t Journal::doneCount() const {
+    return pImpl->done.size();
+}
+
+uint64_t Journal::outputSize() const {
+    return pImpl->size;
+}
+
+void Journal::record(size_t sequence, int64_t timestamp, uint64_t offset) {
+    pImpl->record(sequence, timestamp, offset);
+}
+
+void Journal::sync() {
+    pImpl->sync();
+}
+
+}
@@ -32,11 +32,18 @@
 #include "TreeMetrics.hh"
 #include "FileMetrics.hh"
 #include "Stock.hh"
+#include "OutputWriter.hh"
+#include "JsonWriter.hh"
+#include "ColumnarWriter.hh"
 #include <jsoncpp/json/json.h>
 #include <fstream>
 #include <mutex>
 #include <errno.h>
 #include <sstream>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <string.h>
 
 using namespace std;
 
@@ -55,92 +62,335 @@ const static string *HOUR_NAMES = new string[24] {
     "18 (6pm)", "19 (7pm)", "20 (8pm)", "21 (9pm)", "22 (10pm)", "23 (11pm)"
 };
 
+//
+// In --delta mode render() leaves the file records of a tree for write() to
+// filter: the tree's other records are followed by a NUL, a DeltaHeader and
+// for every file a DeltaBlock, its path and its records.
+//
+struct DeltaHeader {
+    int64_t timestamp;
+    // what the tree's line ages are measured from
+    uint64_t reference;
+};
+
+struct DeltaBlock {
+    uint64_t fingerprint;
+    uint32_t pathLength;
+    uint32_t recordsLength;
+};
+
+// fingerprint of a file in the previous snapshot written
+struct DeltaEntry {
+    uint64_t fingerprint;
+    size_t generation;
+};
+
+void mix(uint64_t& hash, uint64_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+}
+
 }
 
 class JsonReportImpl {
 public:
-    ostream& stream;
-    Json::StreamWriter *writer;
+    Json::StreamWriterBuilder builder;
 
     mutex streamLock;
+    OutputWriter *output;
+    ColumnarWriter *columnar;
+
+    // --delta state, only used by the single thread writing snapshots in
+    // order
+    unordered_map<string, DeltaEntry> deltaFiles;
+    size_t deltaGeneration;
+    string deltaRecords;
+    string deltaPath;
 
-    JsonReportImpl() : stream(*Options.output) {
-        Json::StreamWriterBuilder bldr;
-        bldr["indentation"] = "";
-        writer = bldr.newStreamWriter();
+    JsonReportImpl() : output(nullptr), columnar(nullptr), deltaGeneration(0) {
+        builder["indentation"] = "";
     }
 
 
-    Json::Value& normalize(int64_t timestamp, Json::Value& json) {
-        json["Timestamp"] = (Json::Int64)timestamp;
-        return json;
-    }
+    //
+    // Records are serialized straight into the caller's buffer without
+    // holding any lock. Fields are written in the sorted key order that
+    // jsoncpp would use, see JsonWriter.
+    //
+    void render(const TreeMetrics& tree, string& records) const {
+        if(columnar) {
+            columnar->render(tree, records);
+            return;
+        }
 
-    void report(const TreeMetrics& tree) {
-        unique_lock<mutex> lock(streamLock);
-        ostream& stream = *Options.output;
+        JsonWriter writer(records);
         mpz_class offset = Options.nowTimestamp ? Options.nowTimestamp : tree.lastCommitTimestamp();
-        Json::Value treeJson = tree.toJson(offset);
+        int64_t timestamp = tree.timestamp();
 
-        writer->write(treeJson, &stream);
-        stream << "\n";
+        writer.begin();
+        writer.field("FileCount", (int64_t)tree.fileCount());
+        writeLineAge(writer, tree, offset);
+        writer.field("Timestamp", timestamp);
+        writer.field("_type", "tree");
+        writer.end();
 
-        for(const FileMetrics *file : tree) {
-            Json::Value fileJson = file->toJson(offset);
-            writer->write(normalize(tree.timestamp(), fileJson), &stream);
-            stream << "\n";
-
-            for(const Stock *stock : file->stocks()) {
-                Json::Value stockJson = stock->toJson(offset);
-                stockJson["FilePath"] = file->path();
-                stockJson["_type"] = "stock-file";
-                writer->write(normalize(tree.timestamp(), stockJson), &stream);
-                stream << "\n";
+        if(Options.delta) {
+            for(const Stock* stock : tree.stocks()) {
+                writeStock(writer, *stock, nullptr, offset, timestamp);
             }
+
+            renderDelta(tree, offset, records);
+            return;
+        }
+
+        for(const FileMetrics *file : tree) {
+            writeFile(writer, *file, offset, timestamp);
         }
 
         for(const Stock* stock : tree.stocks()) {
-            Json::Value stockJson = stock->toJson(offset);
-            writer->write(normalize(tree.timestamp(), stockJson), &stream);
-            stream << "\n";
+            writeStock(writer, *stock, nullptr, offset, timestamp);
         }
     }
 
-    void report(const CommitDay& day) {
-        unique_lock<mutex> lock(streamLock);
-        ostream& stream = *Options.output;
-        Json::Value dayJson = day.toJson();
+    void renderDelta(const TreeMetrics& tree, const mpz_class& offset, string& records) const {
+        JsonWriter writer(records);
+        DeltaHeader header;
+        DeltaBlock block;
+
+        header.timestamp = tree.timestamp();
+        header.reference = offset.get_ui();
+        records.push_back('\0');
+        records.append((const char*)&header, sizeof(header));
+
+        for(const FileMetrics *file : tree) {
+            size_t start = records.size();
 
-        writer->write(dayJson, &stream);
-        stream << "\n";
+            records.append(sizeof(block), '\0');
+            records.append(file->path());
+            block.fingerprint = 0;
+            writeFile(writer, *file, offset, header.timestamp, &block.fingerprint);
+            block.pathLength = file->path().size();
+            block.recordsLength = records.size() - start - sizeof(block) - block.pathLength;
+            memcpy(&records[start], &block, sizeof(block));
+        }
+    }
+
+    //
+    // A file's record and its stock-file records. The fingerprint of a file
+    // is the same in two snapshots when all its values but the line ages are,
+    // and the ages differ only by the offset. Stocks are added to it in any
+    // order.
+    //
+    static void writeFile(JsonWriter& writer, const FileMetrics& file, const mpz_class& offset,
+                          int64_t timestamp, uint64_t *fingerprint = nullptr) {
+        writer.begin();
+        writer.field("FilePath", file.path());
+        writeLineAge(writer, file, offset, fingerprint);
+        writer.field("Timestamp", timestamp);
+        writer.field("_type", "file");
+        writer.end();
+
+        for(const Stock *stock : file.stocks()) {
+            writeStock(writer, *stock, &file.path(), offset, timestamp, fingerprint);
+        }
+    }
+
+    void render(const CommitDay& day, string& records) const {
+        if(columnar) {
+            columnar->render(day, records);
+            return;
+        }
+
+        JsonWriter writer(records);
+
+        writer.begin();
+        writer.field("CommitCount", (int64_t)(int)day.commitCount());
+        writer.field("CommitSpanHours", day.commitSpanHours());
+        writer.field("Timestamp", day.timestamp());
+        writer.field("TotalCommitCount", (int64_t)day.totalCommitCount());
+        writer.field("_type", "commit-day");
+        writer.end();
 
         for(git_commit *commit : day.commits()) {
-            Json::Value json = commitToJson(commit);
-            writer->write(json, &stream);
-            stream << "\n";
+            writeCommit(writer, commit);
+        }
+    }
+
+    static void writeLineAge(JsonWriter& writer, const LineAgeMetrics& metrics,
+                             const mpz_class& offset, uint64_t *fingerprint = nullptr) {
+        LineAgeSummary summary;
+
+        metrics.summarize(summary, offset);
+        if(fingerprint) {
+            // the timestamps the ages are taken of, not the ages
+            uint64_t reference = offset.get_ui();
+
+            mix(*fingerprint, summary.lineCount);
+            mix(*fingerprint, summary.firstCommitTimestamp);
+            mix(*fingerprint, summary.lastCommitTimestamp);
+            mix(*fingerprint, reference - summary.mean);
+            mix(*fingerprint, summary.variance);
+            mix(*fingerprint, summary.standardDeviation);
+            if(summary.hasPercentiles) {
+                mix(*fingerprint, reference - summary.median);
+                mix(*fingerprint, reference - summary.p90);
+            }
+        }
+        writer.field("FirstCommitTimestamp", summary.firstCommitTimestamp);
+        writer.field("LastCommitTimestamp", summary.lastCommitTimestamp);
+        writer.field("LineAgeMean", summary.mean);
+        if(summary.hasPercentiles) {
+            writer.field("LineAgeMedian", summary.median);
+            writer.field("LineAgeP90", summary.p90);
+        }
+        writer.field("LineAgeStandardDeviation", summary.standardDeviation);
+        writer.field("LineAgeVariance", summary.variance);
+        writer.field("LineCount", summary.lineCount);
+    }
+
+    // a tree's stock, or a file's (type "stock-file") when filePath is set
+    static void writeStock(JsonWriter& writer, const Stock& stock, const string *filePath,
+                           const mpz_class& offset, int64_t timestamp,
+                           uint64_t *fingerprint = nullptr) {
+        double ownership = stock.ownership();
+        uint64_t stockFingerprint = 0;
+
+        if(fingerprint) {
+            uint64_t bits;
+
+            memcpy(&bits, &ownership, sizeof(bits));
+            stockFingerprint = hash<string>()(stock.email());
+            mix(stockFingerprint, hash<string>()(stock.name()));
+            mix(stockFingerprint, bits);
+        }
+
+        writer.begin();
+        writer.field("AuthorEmail", stock.email());
+        writer.field("AuthorName", stock.name());
+        if(filePath) {
+            writer.field("FilePath", *filePath);
+        }
+        writeLineAge(writer, stock, offset, fingerprint ? &stockFingerprint : nullptr);
+        writer.field("Ownership", ownership);
+        writer.field("Timestamp", timestamp);
+        writer.field("_type", filePath ? "stock-file" : "stock");
+        writer.end();
+
+        if(fingerprint) {
+            *fingerprint += stockFingerprint;
         }
     }
 
-    Json::Value commitToJson(git_commit *commit) const {
-        Json::Value json(Json::objectValue);
+    static void writeCommit(JsonWriter& writer, git_commit *commit) {
         const git_signature *sig = git_commit_committer(commit);
         int64_t timestamp = git_commit_time(commit);
-        tm *t = localtime(&timestamp);
+        tm local;
+        // records are rendered concurrently, so use the reentrant version
+        tm *t = localtime_r(&timestamp, &local);
         const char *msg = git_commit_message(commit);
 
-        json["Message"] = msg ? msg : ""; //git_commit_body(commit);
-        json["Timestamp"] = (Json::Int64)timestamp;
-        json["DayOfTheWeek"] = WEEK_DAY_NAMES[t->tm_wday];
-        json["HourOfTheDay"] = HOUR_NAMES[t->tm_hour];
-        json["_type"] = "commit";
-
+        writer.begin();
         if(sig) {
             pair<string, string> resolved = Options.resolveSignature(sig->email, sig->name);
-            json["AuthorEmail"] = resolved.first;
-            json["AuthorName"] = resolved.second;
+            writer.field("AuthorEmail", resolved.first);
+            writer.field("AuthorName", resolved.second);
+        }
+        writer.field("DayOfTheWeek", WEEK_DAY_NAMES[t->tm_wday]);
+        writer.field("HourOfTheDay", HOUR_NAMES[t->tm_hour]);
+        writer.field("Message", msg ? msg : "");
+        writer.field("Timestamp", timestamp);
+        writer.field("_type", "commit");
+        writer.end();
+    }
+
+    //
+    // Hand records to the output writer, which leaves a recycled buffer in
+    // their place, or write them to the output stream.
+    //
+    void write(string& records, const CommitDay *day) {
+        size_t split;
+
+        if(Options.delta && day && (split = records.find('\0')) != string::npos) {
+            filterDelta(records, split, day);
+        }
+
+        if(output) {
+            output->write(records, day);
+            return;
+        }
+
+        unique_lock<mutex> lock(streamLock);
+        Options.output->write(records.data(), records.size());
+    }
+
+    //
+    // Replace the file records rendered by renderDelta() with a delta record
+    // and the records of the files that changed since the previous snapshot,
+    // or of all files on a keyframe. A file that is written replaces all of
+    // its records, and a file that is gone gets a file-removed record. The
+    // first snapshot written by a run is always a keyframe.
+    //
+    void filterDelta(string& records, size_t split, const CommitDay *day) {
+        const char *p = records.data() + split + 1;
+        const char *end = records.data() + records.size();
+        DeltaHeader header;
+        DeltaBlock block;
+        JsonWriter writer(deltaRecords);
+        uint64_t changed = 0;
+        uint64_t removed = 0;
+        bool keyframe = !deltaGeneration || day->sequence() % Options.keyframeInterval == 0;
+
+        memcpy(&header, p, sizeof(header));
+        p += sizeof(header);
+        ++deltaGeneration;
+
+        while(p < end) {
+            memcpy(&block, p, sizeof(block));
+            p += sizeof(block);
+            deltaPath.assign(p, block.pathLength);
+            p += block.pathLength;
+
+            DeltaEntry& entry = deltaFiles[deltaPath];
+            if(keyframe || entry.generation == 0 || entry.fingerprint != block.fingerprint) {
+                deltaRecords.append(p, block.recordsLength);
+                ++changed;
+            }
+            entry.fingerprint = block.fingerprint;
+            entry.generation = deltaGeneration;
+            p += block.recordsLength;
         }
 
-        return json;
+        for(auto it = deltaFiles.begin(); it != deltaFiles.end();) {
+            if(it->second.generation == deltaGeneration) {
+                ++it;
+                continue;
+            }
+
+            // a keyframe replaces everything, so it needs no removals
+            if(!keyframe) {
+                writer.begin();
+                writer.field("FilePath", it->first);
+                writer.field("Timestamp", header.timestamp);
+                writer.field("_type", "file-removed");
+                writer.end();
+                ++removed;
+            }
+            it = deltaFiles.erase(it);
+        }
+
+        records.resize(split);
+
+        JsonWriter summary(records);
+        summary.begin();
+        summary.field("AgeReference", header.reference);
+        summary.field("ChangedFileCount", changed);
+        summary.field("Keyframe", keyframe);
+        summary.field("RemovedFileCount", removed);
+        summary.field("Timestamp", header.timestamp);
+        summary.field("_type", "delta");
+        summary.end();
+
+        records.append(deltaRecords);
+        deltaRecords.clear();
     }
 };
 
@@ -152,11 +402,46 @@ JsonReport::~JsonReport() {
 }
 
 void JsonReport::report(const CommitDay& day) {
-    pImpl->report(day);
+    string records;
+    pImpl->render(day, records);
+    pImpl->write(records, nullptr);
 }
 
 void JsonReport::report(const TreeMetrics& tree) {
-    pImpl->report(tree);
+    string records;
+    pImpl->render(tree, records);
+    pImpl->write(records, nullptr);
+}
+
+void JsonReport::report(const Json::Value& record) {
+    unique_ptr<Json::StreamWriter> writer(pImpl->builder.newStreamWriter());
+    ostringstream stream;
+
+    writer->write(record, &stream);
+    stream << "\n";
+
+    string records = stream.str();
+    pImpl->write(records, nullptr);
+}
+
+void JsonReport::render(const CommitDay& day, string& records) const {
+    pImpl->render(day, records);
+}
+
+void JsonReport::render(const TreeMetrics& tree, string& records) const {
+    pImpl->render(tree, records);
+}
+
+void JsonReport::write(string& records, const CommitDay *day) {
+    pImpl->write(records, day);
+}
+
+void JsonReport::output(OutputWriter *output) {
+    pImpl->output = output;
+}
+
+void JsonReport::columnar(ColumnarWriter *columnar) {
+    pImpl->columnar = columnar;
 }
 
 
@@ -0,0 +1,255 @@
+
+#include "JsonWriter.hh"
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const unsigned int REPLACEMENT_CHARACTER = 0xfffd;
+
+void appendUnsigned(string& buffer, uint64_t value) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+
+    while(value >= 100) {
+        const char *pair = DIGIT_PAIRS + (value % 100) * 2;
+        value /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+
+    if(value >= 10) {
+        const char *pair = DIGIT_PAIRS + value * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    } else {
+        *--p = '0' + value;
+    }
+
+    buffer.append(p, digits + sizeof(digits) - p);
+}
+
+void appendHex(string& buffer, unsigned int value) {
+    char hex[6] = {
+        '\\', 'u',
+        HEX_DIGITS[(value >> 12) & 0xf], HEX_DIGITS[(value >> 8) & 0xf],
+        HEX_DIGITS[(value >> 4) & 0xf], HEX_DIGITS[value & 0xf]
+    };
+
+    buffer.append(hex, sizeof(hex));
+}
+
+//
+// Decode the code point starting at *s and leave s on its last byte. This
+// follows jsoncpp, including what it makes of invalid sequences: a stray
+// continuation byte starts a two byte sequence, and truncated, overlong or
+// surrogate sequences become U+FFFD.
+//
+unsigned int decodeUtf8(const char *&s, const char *end) {
+    unsigned int lead = (unsigned char)*s;
+
+    if(lead < 0x80) {
+        return lead;
+    }
+
+    if(lead < 0xe0) {
+        if(end - s < 2) {
+            return REPLACEMENT_CHARACTER;
+        }
+
+        unsigned int code = ((lead & 0x1f) << 6) | (s[1] & 0x3f);
+        s += 1;
+        return code < 0x80 ? REPLACEMENT_CHARACTER : code;
+    }
+
+    if(lead < 0xf0) {
+        if(end - s < 3) {
+            return REPLACEMENT_CHARACTER;
+        }
+
+        unsigned int code = ((lead & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+        s += 2;
+        if(code >= 0xd800 && code <= 0xdfff) {
+            return REPLACEMENT_CHARACTER;
+        }
+        return code < 0x800 ? REPLACEMENT_CHARACTER : code;
+    }
+
+    if(lead < 0xf8) {
+        if(end - s < 4) {
+            return REPLACEMENT_CHARACTER;
+        }
+
+        unsigned int code = ((lead & 0x07) << 18) | ((s[1] & 0x3f) << 12) |
+            ((s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+        s += 3;
+        return code < 0x10000 ? REPLACEMENT_CHARACTER : code;
+    }
+
+    return REPLACEMENT_CHARACTER;
+}
+
+}
+
+JsonWriter::JsonWriter(string& buffer) : buffer(buffer), first(true) {
+}
+
+void JsonWriter::begin() {
+    buffer += '{';
+    first = true;
+}
+
+void JsonWriter::end() {
+    buffer.append("}\n", 2);
+}
+
+void JsonWriter::key(const char *key) {
+    if(!first) {
+        buffer += ',';
+    }
+    first = false;
+
+    buffer += '"';
+    buffer.append(key);
+    buffer.append("\":", 2);
+}
+
+void JsonWriter::field(const char *key, const std::string& value) {
+    this->key(key);
+    quoted(value.data(), value.size());
+}
+
+void JsonWriter::field(const char *key, const char *value) {
+    this->key(key);
+    quoted(value, strlen(value));
+}
+
+void JsonWriter::field(const char *key, const char *value, size_t length) {
+    this->key(key);
+    quoted(value, length);
+}
+
+void JsonWriter::field(const char *key, int64_t value) {
+    this->key(key);
+
+    if(value < 0) {
+        buffer += '-';
+        appendUnsigned(buffer, -(uint64_t)value);
+    } else {
+        appendUnsigned(buffer, value);
+    }
+}
+
+void JsonWriter::field(const char *key, uint64_t value) {
+    this->key(key);
+    appendUnsigned(buffer, value);
+}
+
+void JsonWriter::field(const char *key, bool value) {
+    this->key(key);
+    buffer.append(value ? "true" : "false");
+}
+
+void JsonWriter::field(const char *key, double value) {
+    char digits[32];
+    int length;
+
+    this->key(key);
+
+    if(isnan(value)) {
+        buffer.append("null");
+        return;
+    } else if(isinf(value)) {
+        buffer.append(value < 0 ? "-1e+9999" : "1e+9999");
+        return;
+    }
+
+    // %.17g is at most 24 characters
+    length = snprintf(digits, sizeof(digits), "%.17g", value);
+    buffer.append(digits, length);
+
+    // keep it recognizable as a double, as jsoncpp does
+    if(!memchr(digits, '.', length) && !memchr(digits, 'e', length)) {
+        buffer.append(".0", 2);
+    }
+}
+
+void JsonWriter::quoted(const char *value, size_t length) {
+    const char *end = value + length;
+    const char *plain = value;
+
+    buffer += '"';
+
+    for(const char *c = value; c != end; ++c) {
+        unsigned char ch = *c;
+
+        if(ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\') {
+            continue;
+        }
+
+        // copy the run of characters that need no escaping in one go
+        buffer.append(plain, c - plain);
+
+        switch(ch) {
+        case '"':
+            buffer.append("\\\"", 2);
+            break;
+        case '\\':
+            buffer.append("\\\\", 2);
+            break;
+        case '\b':
+            buffer.append("\\b", 2);
+            break;
+        case '\f':
+            buffer.append("\\f", 2);
+            break;
+        case '\n':
+            buffer.append("\\n", 2);
+            break;
+        case '\r':
+            buffer.append("\\r", 2);
+            break;
+        case '\t':
+            buffer.append("\\t", 2);
+            break;
+        default: {
+            unsigned int code = decodeUtf8(c, end);
+
+            if(code < 0x10000) {
+                appendHex(buffer, code);
+            } else {
+                // outside the basic multilingual plane, as a surrogate pair
+                code -= 0x10000;
+                appendHex(buffer, 0xd800 + ((code >> 10) & 0x3ff));
+                appendHex(buffer, 0xdc00 + (code & 0x3ff));
+            }
+        }
+        }
+
+        plain = c + 1;
+    }
+
+    buffer.append(plain, end - plain);
+    buffer += '"';
+}
+
+}
@@ -1,6 +1,7 @@
 
 #include "LineAgeMetrics.hh"
 #include "Options.hh"
+#include "LineAgeSketch.hh"
 #include <iostream>
 #include <math.h>
 #include <jsoncpp/json/json.h>
@@ -10,33 +11,115 @@ using namespace std;
 
 namespace gitstock {
 
+namespace {
+
+mpz_class toMpz(__int128 value) {
+	bool negative = value < 0;
+	unsigned __int128 magnitude = negative ? -(unsigned __int128)value : value;
+	mpz_class result((unsigned long)(uint64_t)(magnitude >> 64));
+
+	result <<= 64;
+	result += (unsigned long)(uint64_t)magnitude;
+
+	return negative ? mpz_class(-result) : result;
+}
+
+mpz_class toMpz(uint64_t value) {
+	return mpz_class((unsigned long)value);
+}
+
+// the low 64 bits of |value|, which is what mpz_class::get_ui() returns
+uint64_t magnitude(__int128 value) {
+	return (uint64_t)(value < 0 ? -(unsigned __int128)value : (unsigned __int128)value);
+}
+
+// floor(sqrt(value)) for value > 0, like mpz sqrt()
+uint64_t squareRoot(__int128 value) {
+	unsigned __int128 v = value;
+	unsigned __int128 root = (unsigned __int128)sqrtl((long double)v);
+
+	while(root * root > v) {
+		--root;
+	}
+	while((root + 1) * (root + 1) <= v) {
+		++root;
+	}
+
+	return (uint64_t)root;
+}
+
+}
+
 class LineAgeMetricsImpl {
 public:
-	mpz_class count;
 	mpz_class sum;
 	mpz_class sqsum;
-	mpz_class firstCommitTimestamp;
-	mpz_class lastCommitTimestamp;
 
-	LineAgeMetricsImpl()
-		: count(0), sum(0), sqsum(0), firstCommitTimestamp(0),
-		lastCommitTimestamp(0) {
+	LineAgeMetricsImpl(const mpz_class& sum, const mpz_class& sqsum)
+		: sum(sum), sqsum(sqsum) {
 	}
 };
 
-LineAgeMetrics::LineAgeMetrics() : pImpl(new LineAgeMetricsImpl) {
+LineAgeMetrics::LineAgeMetrics()
+	: count(0), first(0), last(0), fixedSum(0), fixedSqsum(0), wide(nullptr),
+	sketch(Options.percentiles ? new LineAgeSketch() : nullptr) {
+#ifdef GITSTOCK_GMP_ACCUMULATORS
+	widen();
+#endif
+}
+
+LineAgeMetrics::LineAgeMetrics(const LineAgeMetrics& other)
+	: count(other.count), first(other.first), last(other.last),
+	fixedSum(other.fixedSum), fixedSqsum(other.fixedSqsum),
+	wide(other.wide ? new LineAgeMetricsImpl(*other.wide) : nullptr),
+	sketch(other.sketch ? new LineAgeSketch(*other.sketch) : nullptr) {
 }
 
 LineAgeMetrics::~LineAgeMetrics() {
-	delete pImpl;
+	delete wide;
+	delete sketch;
 }
 
-const mpz_class& LineAgeMetrics::lastCommitTimestamp() const {
-	return pImpl->lastCommitTimestamp;
+LineAgeMetrics& LineAgeMetrics::operator=(const LineAgeMetrics& other) {
+	if(this != &other) {
+		LineAgeMetricsImpl *otherWide = other.wide ? new LineAgeMetricsImpl(*other.wide) : nullptr;
+		LineAgeSketch *otherSketch = other.sketch ? new LineAgeSketch(*other.sketch) : nullptr;
+
+		delete wide;
+		delete sketch;
+
+		count = other.count;
+		first = other.first;
+		last = other.last;
+		fixedSum = other.fixedSum;
+		fixedSqsum = other.fixedSqsum;
+		wide = otherWide;
+		sketch = otherSketch;
+	}
+
+	return *this;
+}
+
+void LineAgeMetrics::widen() {
+	if(!wide) {
+		wide = new LineAgeMetricsImpl(toMpz(fixedSum), toMpz(fixedSqsum));
+	}
+}
+
+mpz_class LineAgeMetrics::sum() const {
+	return wide ? wide->sum : toMpz(fixedSum);
+}
+
+mpz_class LineAgeMetrics::sqsum() const {
+	return wide ? wide->sqsum : toMpz(fixedSqsum);
 }
 
-const mpz_class& LineAgeMetrics::firstCommitTimestamp() const {
-	return pImpl->firstCommitTimestamp;
+mpz_class LineAgeMetrics::lastCommitTimestamp() const {
+	return toMpz(last);
+}
+
+mpz_class LineAgeMetrics::firstCommitTimestamp() const {
+	return toMpz(first);
 }
 /*
 mpz_class LineAgeMetrics::sum(const mpz_class& offset) const {
@@ -49,11 +132,12 @@ mpz_class LineAgeMetrics::sqsum(const mpz_class& offset) const {
 		: pImpl->sqsum;
 }
 */
-const mpz_class& LineAgeMetrics::lineCount() const {
-	return pImpl->count;
+mpz_class LineAgeMetrics::lineCount() const {
+	return toMpz(count);
 }
 
 mpz_class LineAgeMetrics::lineAgeVariance(const mpz_class& offset) const {
+	mpz_class count = toMpz(this->count);
 	mpz_class sum, sqsum;
 
 	if(offset) {
@@ -64,19 +148,20 @@ mpz_class LineAgeMetrics::lineAgeVariance(const mpz_class& offset) const {
 		//         = a2 + b2 + c2 - 2x(a + b + c) + 3x2
 		//         = sqsum - 2x(sum) + 3x^2
 		//
-		sum = (pImpl->count * offset) - pImpl->sum;
-		sqsum = pImpl->sqsum - (2 * offset * pImpl->sum) + (pImpl->count * offset * offset);
+		sum = (count * offset) - this->sum();
+		sqsum = this->sqsum() - (2 * offset * this->sum()) + (count * offset * offset);
 	} else {
-		sum = pImpl->sum;
-		sqsum = pImpl->sqsum;
+		sum = this->sum();
+		sqsum = this->sqsum();
 	}
 
-	return pImpl->count > 1 ?
-		(sqsum - (sum * sum) / pImpl->count) / (pImpl->count - 1)
+	return count > 1 ?
+		(sqsum - (sum * sum) / count) / (count - 1)
 		: mpz_class(0);
 }
 
 mpz_class LineAgeMetrics::lineAgeMean(const mpz_class& offset) const {
+	mpz_class count = toMpz(this->count);
 	mpz_class sum;
 
 	if(offset) {
@@ -86,12 +171,12 @@ mpz_class LineAgeMetrics::lineAgeMean(const mpz_class& offset) const {
 		//       = -a - b - c + 3(offset)
 		//       = 3(offset) - sum
 		//
-		sum = (offset * pImpl->count) - pImpl->sum;
+		sum = (offset * count) - this->sum();
 	} else {
-		sum = pImpl->sum;
+		sum = this->sum();
 	}
 
-	return pImpl->count > 0 ? sum / pImpl->count : mpz_class(0);
+	return count > 0 ? sum / count : mpz_class(0);
 }
 
 mpz_class LineAgeMetrics::lineAgeStandardDeviation(const mpz_class& offset) const {
@@ -99,6 +184,30 @@ mpz_class LineAgeMetrics::lineAgeStandardDeviation(const mpz_class& offset) cons
 	mpz_class var = lineAgeVariance(offset);
 	return var > 0 ? sqrt(var) : mpz_class(0);
 }
+bool LineAgeMetrics::hasLineAgePercentiles() const {
+	return sketch != nullptr;
+}
+
+mpz_class LineAgeMetrics::lineAgePercentile(double percentile, const mpz_class& offset) const {
+	if(!sketch || !count) {
+		return 0;
+	}
+
+	if(!offset) {
+		return toMpz(sketch->quantile(percentile / 100.0));
+	}
+
+	// the oldest lines have the smallest timestamps
+	mpz_class timestamp = toMpz(sketch->quantile(1.0 - percentile / 100.0));
+	if(timestamp < first) {
+		timestamp = toMpz(first);
+	} else if(timestamp > last) {
+		timestamp = toMpz(last);
+	}
+
+	return offset > timestamp ? mpz_class(offset - timestamp) : mpz_class(0);
+}
+
 /*
 mpz_class LineAgeMetrics::localSum() const {
 	return sum(pImpl->lastCommitTimestamp);
@@ -133,46 +242,187 @@ mpz_class LineAgeMetrics::globalStandardDeviation() const {
 }
 */
 void LineAgeMetrics::addLineBlock(uint64_t timestamp, int count) {
-	mpz_class diff = timestamp * count;
-	pImpl->count += count;
-	pImpl->sum += diff;
+	//
+	// A block of count lines with the same timestamp adds count * t to the
+	// sum and count * t^2 to the sum of squares. Fall back to GMP when either
+	// doesn't fit in 128 bits.
+	//
+	if(!wide) {
+		__int128 t = timestamp;
+		__int128 blockSum, blockSqsum, newSum, newSqsum;
+
+		if(__builtin_mul_overflow(t, (__int128)count, &blockSum)
+		   || __builtin_mul_overflow(blockSum, t, &blockSqsum)
+		   || __builtin_add_overflow(fixedSum, blockSum, &newSum)
+		   || __builtin_add_overflow(fixedSqsum, blockSqsum, &newSqsum)) {
+			widen();
+		} else {
+			fixedSum = newSum;
+			fixedSqsum = newSqsum;
+		}
+	}
 
-	for(int i = 0; i < count; ++i) {
-		pImpl->sqsum += timestamp * timestamp;
+	if(wide) {
+		mpz_class blockSum = toMpz(timestamp) * count;
+		wide->sum += blockSum;
+		wide->sqsum += blockSum * toMpz(timestamp);
 	}
-	//pImpl->sqsum += diff * diff;
 
-	if(!pImpl->firstCommitTimestamp || pImpl->firstCommitTimestamp > timestamp) {
-		pImpl->firstCommitTimestamp = timestamp;
+	this->count += count;
+
+	if(sketch) {
+		sketch->add(timestamp, count);
 	}
 
-	if(timestamp > pImpl->lastCommitTimestamp) {
-		pImpl->lastCommitTimestamp = timestamp;
+	if(!first || first > timestamp) {
+		first = timestamp;
+	}
+
+	if(timestamp > last) {
+		last = timestamp;
 	}
 }
 
 void LineAgeMetrics::updateLineAgeMetrics(const LineAgeMetrics& other) {
-	pImpl->count += other.pImpl->count;
-	pImpl->sum += other.pImpl->sum;
-	pImpl->sqsum += other.pImpl->sqsum;
+	if(!other.count) {
+		// nothing to merge and the commit timestamps of other are unset
+		return;
+	}
+
+	if(!wide && !other.wide) {
+		__int128 newSum, newSqsum;
 
-	if(!pImpl->firstCommitTimestamp || pImpl->firstCommitTimestamp > other.pImpl->firstCommitTimestamp) {
-		pImpl->firstCommitTimestamp = other.pImpl->firstCommitTimestamp;
+		if(__builtin_add_overflow(fixedSum, other.fixedSum, &newSum)
+		   || __builtin_add_overflow(fixedSqsum, other.fixedSqsum, &newSqsum)) {
+			widen();
+		} else {
+			fixedSum = newSum;
+			fixedSqsum = newSqsum;
+		}
+	} else {
+		widen();
 	}
 
-	if(other.pImpl->lastCommitTimestamp > pImpl->lastCommitTimestamp) {
-		pImpl->lastCommitTimestamp = other.pImpl->lastCommitTimestamp;
+	if(wide) {
+		wide->sum += other.sum();
+		wide->sqsum += other.sqsum();
+	}
+
+	count += other.count;
+
+	if(other.sketch) {
+		if(!sketch) {
+			sketch = new LineAgeSketch();
+		}
+		sketch->merge(*other.sketch);
+	}
+
+	if(!first || first > other.first) {
+		first = other.first;
+	}
+
+	if(other.last > last) {
+		last = other.last;
 	}
 }
 
 void LineAgeMetrics::toJson(Json::Value& json, const mpz_class& offset) const {
+    LineAgeSummary summary;
+
+    summarize(summary, offset);
+
     json = Json::objectValue;
-    json["LineCount"] = (Json::UInt64)pImpl->count.get_ui();
-    json["FirstCommitTimestamp"] = (Json::UInt64)pImpl->firstCommitTimestamp.get_ui();
-    json["LastCommitTimestamp"] = (Json::UInt64)pImpl->lastCommitTimestamp.get_ui();
-    json["LineAgeVariance"] = (Json::UInt64)lineAgeVariance(offset).get_ui();
-    json["LineAgeStandardDeviation"] = (Json::UInt64)lineAgeStandardDeviation(offset).get_ui();
-    json["LineAgeMean"] = (Json::UInt64)lineAgeMean(offset).get_ui();
+    json["LineCount"] = (Json::UInt64)summary.lineCount;
+    json["FirstCommitTimestamp"] = (Json::UInt64)summary.firstCommitTimestamp;
+    json["LastCommitTimestamp"] = (Json::UInt64)summary.lastCommitTimestamp;
+    json["LineAgeVariance"] = (Json::UInt64)summary.variance;
+    json["LineAgeStandardDeviation"] = (Json::UInt64)summary.standardDeviation;
+    json["LineAgeMean"] = (Json::UInt64)summary.mean;
+
+    if(summary.hasPercentiles) {
+        json["LineAgeMedian"] = (Json::UInt64)summary.median;
+        json["LineAgeP90"] = (Json::UInt64)summary.p90;
+    }
+}
+
+void LineAgeMetrics::summarize(LineAgeSummary& summary, const mpz_class& offset) const {
+    summary.lineCount = count;
+    summary.firstCommitTimestamp = first;
+    summary.lastCommitTimestamp = last;
+    summary.hasPercentiles = sketch != nullptr;
+    summary.median = 0;
+    summary.p90 = 0;
+
+    if(wide || !offset.fits_slong_p() || !summarizeFixed(summary, offset.get_si())) {
+        // get_ui() is the low word of the magnitude, as described above
+        summary.mean = lineAgeMean(offset).get_ui();
+        summary.variance = lineAgeVariance(offset).get_ui();
+        summary.standardDeviation = lineAgeStandardDeviation(offset).get_ui();
+
+        if(sketch) {
+            summary.median = lineAgePercentile(50, offset).get_ui();
+            summary.p90 = lineAgePercentile(90, offset).get_ui();
+        }
+    }
+}
+
+//
+// The same arithmetic as lineAgeMean(), lineAgeVariance() and
+// lineAgePercentile() (truncating division, floor square root) on the fixed
+// width sums. Returns false if any step overflows.
+//
+bool LineAgeMetrics::summarizeFixed(LineAgeSummary& summary, int64_t offset) const {
+	__int128 n = count;
+	__int128 x = offset;
+	__int128 sum, sqsum, product, variance;
+
+	if(offset) {
+		__int128 twoXSum, nXX;
+
+		if(__builtin_mul_overflow(x, n, &product)
+		   || __builtin_sub_overflow(product, fixedSum, &sum)
+		   || __builtin_mul_overflow(fixedSum, 2 * x, &twoXSum)
+		   || __builtin_mul_overflow(product, x, &nXX)
+		   || __builtin_sub_overflow(fixedSqsum, twoXSum, &sqsum)
+		   || __builtin_add_overflow(sqsum, nXX, &sqsum)) {
+			return false;
+		}
+	} else {
+		sum = fixedSum;
+		sqsum = fixedSqsum;
+	}
+
+	if(n > 1) {
+		if(__builtin_mul_overflow(sum, sum, &product)) {
+			return false;
+		}
+		variance = (sqsum - product / n) / (n - 1);
+	} else {
+		variance = 0;
+	}
+
+	summary.mean = magnitude(n > 0 ? sum / n : 0);
+	summary.variance = magnitude(variance);
+	summary.standardDeviation = variance > 0 ? squareRoot(variance) : 0;
+
+	if(sketch && count) {
+		if(!offset) {
+			summary.median = sketch->quantile(0.5);
+			summary.p90 = sketch->quantile(0.9);
+		} else {
+			summary.median = percentileAge(sketch->quantile(1.0 - 0.5), offset);
+			summary.p90 = percentileAge(sketch->quantile(1.0 - 0.9), offset);
+		}
+	}
+
+	return true;
+}
+
+uint64_t LineAgeMetrics::percentileAge(uint64_t timestamp, int64_t offset) const {
+	// the oldest lines have the smallest timestamps
+	__int128 t = timestamp < first ? first : timestamp > last ? last : timestamp;
+
+	return offset > t ? magnitude(offset - t) : 0;
 }
 
 
@@ -0,0 +1,126 @@
+
+#include "LineAgeSketch.hh"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+typedef pair<uint64_t, uint64_t> Bucket;
+
+struct BucketKeyCompare {
+    bool operator() (const Bucket& bucket, uint64_t key) const {
+        return bucket.first < key;
+    }
+};
+
+void addBucket(vector<Bucket>& buckets, uint64_t key, uint64_t count) {
+    auto it = lower_bound(buckets.begin(), buckets.end(), key, BucketKeyCompare());
+    if(it != buckets.end() && it->first == key) {
+        it->second += count;
+    } else {
+        buckets.insert(it, Bucket(key, count));
+    }
+}
+
+}
+
+LineAgeSketch::LineAgeSketch() : shift(0), total(0) {
+}
+
+void LineAgeSketch::add(uint64_t timestamp, uint64_t count) {
+    addBucket(buckets, timestamp >> shift, count);
+    total += count;
+
+    if(buckets.size() > MAX_BUCKETS) {
+        collapse();
+    }
+}
+
+void LineAgeSketch::merge(const LineAgeSketch& other) {
+    unsigned int target = max(shift, other.shift);
+    vector<Bucket> merged;
+
+    merged.reserve(buckets.size() + other.buckets.size());
+
+    // both sides are sorted, so rebucketing keeps them sorted
+    vector<Bucket>::const_iterator left = buckets.begin(), right = other.buckets.begin();
+    while(left != buckets.end() || right != other.buckets.end()) {
+        Bucket bucket;
+        if(right == other.buckets.end()
+           || (left != buckets.end() && (left->first >> (target - shift)) <= (right->first >> (target - other.shift)))) {
+            bucket = Bucket(left->first >> (target - shift), left->second);
+            ++left;
+        } else {
+            bucket = Bucket(right->first >> (target - other.shift), right->second);
+            ++right;
+        }
+
+        if(!merged.empty() && merged.back().first == bucket.first) {
+            merged.back().second += bucket.second;
+        } else {
+            merged.push_back(bucket);
+        }
+    }
+
+    buckets.swap(merged);
+    shift = target;
+    total += other.total;
+
+    if(buckets.size() > MAX_BUCKETS) {
+        collapse();
+    }
+}
+
+void LineAgeSketch::collapse() {
+    while(buckets.size() > MAX_BUCKETS) {
+        size_t out = 0;
+
+        ++shift;
+        for(size_t i = 0; i < buckets.size(); ++i) {
+            uint64_t key = buckets[i].first >> 1;
+            if(out && buckets[out - 1].first == key) {
+                buckets[out - 1].second += buckets[i].second;
+            } else {
+                buckets[out].first = key;
+                buckets[out].second = buckets[i].second;
+                ++out;
+            }
+        }
+
+        buckets.resize(out);
+    }
+}
+
+uint64_t LineAgeSketch::count() const {
+    return total;
+}
+
+uint64_t LineAgeSketch::quantile(double fraction) const {
+    if(!total) {
+        return 0;
+    }
+
+    // nearest rank
+    uint64_t rank = (uint64_t)ceil(fraction * total);
+    uint64_t seen = 0;
+
+    if(rank < 1) {
+        rank = 1;
+    }
+
+    for(const Bucket& bucket : buckets) {
+        seen += bucket.second;
+        if(seen >= rank) {
+            // middle of the bucket, exact while buckets are one second wide
+            return (bucket.first << shift) + ((1ull << shift) >> 1);
+        }
+    }
+
+    return (buckets.back().first << shift) + ((1ull << shift) >> 1);
+}
+
+}
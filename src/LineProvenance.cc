@@ -0,0 +1,445 @@
+
+#include "LineProvenance.hh"
+#include "CommitStore.hh"
+#include "Options.hh"
+#include "util.hh"
+#include <git2/revwalk.h>
+#include <git2/diff.h>
+#include <git2/patch.h>
+#include <git2/tree.h>
+#include <git2/blob.h>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+struct WalkCommit {
+    git_oid id;
+    // indices of the parents in the walk, first parent first
+    vector<uint32_t> parents;
+    uint32_t children;
+};
+
+struct DiffHunk {
+    size_t oldStart;
+    size_t oldLines;
+    size_t newStart;
+    size_t newLines;
+};
+
+void readHunks(git_patch *patch, vector<DiffHunk>& hunks) {
+    size_t count = git_patch_num_hunks(patch);
+
+    hunks.clear();
+    for(size_t i = 0; i < count; ++i) {
+        const git_diff_hunk *hunk;
+        size_t lines;
+
+        if(!git_patch_get_hunk(&hunk, &lines, patch, i)) {
+            DiffHunk h;
+            h.oldStart = hunk->old_start;
+            h.oldLines = hunk->old_lines;
+            h.newStart = hunk->new_start;
+            h.newLines = hunk->new_lines;
+            hunks.push_back(h);
+        }
+    }
+}
+
+size_t newLineCount(const vector<DiffHunk>& hunks, size_t oldCount) {
+    size_t count = oldCount;
+    for(const DiffHunk& hunk : hunks) {
+        count += hunk.newLines;
+        count -= hunk.oldLines;
+    }
+
+    return count;
+}
+
+//
+// Calls map(oldLine, newLine) for every line outside of the hunks of a zero
+// context diff, i.e. every line that is the same in both files. Line numbers
+// are zero based. A hunk that doesn't remove any lines starts *after* its
+// start line, which is why empty ranges are handled separately.
+//
+template<typename F>
+void mapUnchangedLines(const vector<DiffHunk>& hunks, size_t oldCount, size_t newCount, F map) {
+    size_t oldLine = 0, newLine = 0;
+
+    for(const DiffHunk& hunk : hunks) {
+        size_t oldEnd = hunk.oldLines ? hunk.oldStart - 1 : hunk.oldStart;
+        size_t newEnd = hunk.newLines ? hunk.newStart - 1 : hunk.newStart;
+
+        while(oldLine < oldEnd && newLine < newEnd && oldLine < oldCount && newLine < newCount) {
+            map(oldLine++, newLine++);
+        }
+
+        oldLine = oldEnd + hunk.oldLines;
+        newLine = newEnd + hunk.newLines;
+    }
+
+    while(oldLine < oldCount && newLine < newCount) {
+        map(oldLine++, newLine++);
+    }
+}
+
+bool isTrackedMode(uint16_t mode) {
+    return mode == GIT_FILEMODE_BLOB || mode == GIT_FILEMODE_BLOB_EXECUTABLE;
+}
+
+}
+
+const LineOrigins* ProvenanceSnapshot::find(const string& path) const {
+    auto it = files.find(path);
+    return it != files.end() ? it->second.get() : nullptr;
+}
+
+int ProvenanceSnapshot::fileCount() const {
+    return files.size();
+}
+
+class LineProvenanceImpl {
+public:
+    git_repository *repo;
+    git_oid head;
+    vector<WalkCommit> commits;
+    git_diff_options diffOptions;
+
+    LineProvenanceImpl(git_commit *head) : repo(git_commit_owner(head)) {
+        git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+
+        git_oid_cpy(&this->head, git_commit_id(head));
+
+        // only changed lines matter, unchanged lines are mapped from the
+        // parent's origins
+        opts.context_lines = 0;
+        opts.interhunk_lines = 0;
+        diffOptions = opts;
+
+        load();
+    }
+
+    void load() {
+        unordered_map<git_oid, uint32_t, OidHash, OidEqual> index;
+        git_revwalk *walk;
+        git_oid id;
+
+        git_revwalk_new(&walk, repo);
+        git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+        git_revwalk_push(walk, &head);
+
+        while(!git_revwalk_next(&id, walk)) {
+            WalkCommit commit;
+            git_oid_cpy(&commit.id, &id);
+            commit.children = 0;
+
+            index[id] = commits.size();
+            commits.push_back(commit);
+        }
+
+        git_revwalk_free(walk);
+
+        for(WalkCommit& walkCommit : commits) {
+            git_commit *commit;
+
+            if(git_commit_lookup(&commit, repo, &walkCommit.id)) {
+                continue;
+            }
+
+            unsigned int parents = git_commit_parentcount(commit);
+            for(unsigned int i = 0; i < parents; ++i) {
+                auto it = index.find(*git_commit_parent_id(commit, i));
+                if(it != index.end()) {
+                    walkCommit.parents.push_back(it->second);
+                    ++commits[it->second].children;
+                }
+            }
+
+            git_commit_free(commit);
+        }
+    }
+
+    void walk(const LineProvenance::Visitor& visitor) {
+        vector<ProvenanceSnapshot*> snapshots(commits.size(), nullptr);
+        vector<uint32_t> remaining(commits.size());
+
+        for(size_t i = 0; i < commits.size(); ++i) {
+            remaining[i] = commits[i].children;
+        }
+
+        for(size_t i = 0; i < commits.size(); ++i) {
+            const WalkCommit& walkCommit = commits[i];
+            git_commit *commit;
+
+            if(git_commit_lookup(&commit, repo, &walkCommit.id)) {
+                continue;
+            }
+
+            ProvenanceSnapshot *snapshot = apply(commit, walkCommit, snapshots, remaining);
+            bool proceed = visitor(commit, *snapshot);
+
+            for(uint32_t parent : walkCommit.parents) {
+                if(--remaining[parent] == 0) {
+                    delete snapshots[parent];
+                    snapshots[parent] = nullptr;
+                }
+            }
+
+            if(remaining[i]) {
+                snapshots[i] = snapshot;
+            } else {
+                delete snapshot;
+            }
+
+            git_commit_free(commit);
+
+            if(!proceed) {
+                break;
+            }
+        }
+
+        for(ProvenanceSnapshot *snapshot : snapshots) {
+            delete snapshot;
+        }
+    }
+
+    git_tree* lookupTree(const git_oid& id) {
+        git_commit *commit;
+        git_tree *tree = nullptr;
+
+        if(!git_commit_lookup(&commit, repo, &id)) {
+            git_commit_tree(&tree, commit);
+            git_commit_free(commit);
+        }
+
+        return tree;
+    }
+
+    ProvenanceSnapshot* apply(git_commit *commit, const WalkCommit& walkCommit,
+                              vector<ProvenanceSnapshot*>& snapshots,
+                              const vector<uint32_t>& remaining) {
+        ProvenanceSnapshot *snapshot;
+        vector<git_tree*> parentTrees;
+        git_tree *tree;
+        git_diff *diff;
+        CommitInfo info;
+        LineOrigin origin;
+
+        if(walkCommit.parents.empty() || !snapshots[walkCommit.parents[0]]) {
+            snapshot = new ProvenanceSnapshot();
+        } else {
+            uint32_t first = walkCommit.parents[0];
+            if(remaining[first] == 1) {
+                // this is the last child, take over the parent's snapshot
+                snapshot = snapshots[first];
+                snapshots[first] = nullptr;
+            } else {
+                snapshot = new ProvenanceSnapshot(*snapshots[first]);
+            }
+        }
+
+        CommitStore::get().lookup(repo, git_commit_id(commit), info);
+        origin.timestamp = info.timestamp;
+        origin.author = info.author;
+
+        for(uint32_t parent : walkCommit.parents) {
+            parentTrees.push_back(lookupTree(commits[parent].id));
+        }
+
+        git_commit_tree(&tree, commit);
+
+        if(git_diff_tree_to_tree(&diff, repo, parentTrees.empty() ? nullptr : parentTrees[0],
+                                 tree, &diffOptions)) {
+            git_tree_free(tree);
+            for(git_tree *parentTree : parentTrees) {
+                git_tree_free(parentTree);
+            }
+            return snapshot;
+        }
+
+        git_diff_find_options findOptions = GIT_DIFF_FIND_OPTIONS_INIT;
+        findOptions.flags = GIT_DIFF_FIND_RENAMES;
+        git_diff_find_similar(diff, &findOptions);
+
+        size_t deltas = git_diff_num_deltas(diff);
+        for(size_t i = 0; i < deltas; ++i) {
+            applyDelta(diff, i, origin, walkCommit, snapshot, snapshots, parentTrees);
+        }
+
+        git_diff_free(diff);
+        git_tree_free(tree);
+        for(git_tree *parentTree : parentTrees) {
+            git_tree_free(parentTree);
+        }
+
+        return snapshot;
+    }
+
+    void applyDelta(git_diff *diff, size_t index, const LineOrigin& origin,
+                    const WalkCommit& walkCommit, ProvenanceSnapshot *snapshot,
+                    const vector<ProvenanceSnapshot*>& snapshots,
+                    const vector<git_tree*>& parentTrees) {
+        const git_diff_delta *delta = git_diff_get_delta(diff, index);
+        shared_ptr<const LineOrigins> old;
+        string path = delta->new_file.path;
+        git_patch *patch;
+        vector<DiffHunk> hunks;
+
+        if(delta->status != GIT_DELTA_ADDED) {
+            auto it = snapshot->files.find(delta->old_file.path);
+            if(it != snapshot->files.end()) {
+                old = it->second;
+            }
+        }
+
+        if(delta->status == GIT_DELTA_DELETED || delta->status == GIT_DELTA_RENAMED) {
+            snapshot->files.erase(delta->old_file.path);
+        }
+
+        if(delta->status == GIT_DELTA_DELETED) {
+            return;
+        }
+
+        if(!isTrackedMode(delta->new_file.mode) || Options.shouldIgnorePath(path)) {
+            snapshot->files.erase(path);
+            return;
+        }
+
+        if(git_patch_from_diff(&patch, diff, index)) {
+            snapshot->files.erase(path);
+            return;
+        }
+
+        if(git_patch_get_delta(patch)->flags & GIT_DIFF_FLAG_BINARY) {
+            git_patch_free(patch);
+            snapshot->files.erase(path);
+            return;
+        }
+
+        if(!old && delta->status != GIT_DELTA_ADDED) {
+            // the previous version wasn't tracked (it was binary or not a
+            // regular file), so every line is new
+            git_patch_free(patch);
+            if(diffAgainstEmpty(delta->new_file.id, path, &patch)) {
+                snapshot->files.erase(path);
+                return;
+            }
+        }
+
+        readHunks(patch, hunks);
+        git_patch_free(patch);
+
+        size_t oldCount = old ? old->size() : 0;
+        LineOrigins *origins = new LineOrigins(newLineCount(hunks, oldCount), origin);
+        vector<bool> added(origins->size(), true);
+
+        if(old) {
+            mapUnchangedLines(hunks, oldCount, origins->size(), [&](size_t o, size_t n) {
+                (*origins)[n] = (*old)[o];
+                added[n] = false;
+            });
+        }
+
+        //
+        // Lines that are new relative to the first parent of a merge usually
+        // come from one of the other parents. Like blame, only lines that are
+        // new relative to every parent are attributed to the merge itself.
+        //
+        for(size_t p = 1; p < walkCommit.parents.size(); ++p) {
+            const ProvenanceSnapshot *other = snapshots[walkCommit.parents[p]];
+            const LineOrigins *otherOrigins = other ? other->find(path) : nullptr;
+
+            if(otherOrigins && parentTrees[p]) {
+                inheritFromParent(parentTrees[p], path, delta->new_file.id,
+                                  *otherOrigins, *origins, added);
+            }
+        }
+
+        snapshot->files[path] = shared_ptr<const LineOrigins>(origins);
+    }
+
+    int diffAgainstEmpty(const git_oid& id, const string& path, git_patch **patch) {
+        git_blob *blob;
+        int rc;
+
+        if((rc = git_blob_lookup(&blob, repo, &id))) {
+            return rc;
+        }
+
+        rc = git_patch_from_blobs(patch, nullptr, nullptr, blob, path.c_str(), &diffOptions);
+        git_blob_free(blob);
+
+        return rc;
+    }
+
+    void inheritFromParent(git_tree *parentTree, const string& path, const git_oid& id,
+                           const LineOrigins& parentOrigins, LineOrigins& origins,
+                           vector<bool>& added) {
+        git_tree_entry *entry;
+        git_blob *oldBlob, *newBlob;
+        git_patch *patch;
+        vector<DiffHunk> hunks;
+
+        if(git_tree_entry_bypath(&entry, parentTree, path.c_str())) {
+            return;
+        }
+
+        if(git_oid_equal(git_tree_entry_id(entry), &id)) {
+            // same content as in this parent
+            git_tree_entry_free(entry);
+            for(size_t i = 0; i < origins.size() && i < parentOrigins.size(); ++i) {
+                if(added[i]) {
+                    origins[i] = parentOrigins[i];
+                    added[i] = false;
+                }
+            }
+            return;
+        }
+
+        if(git_blob_lookup(&oldBlob, repo, git_tree_entry_id(entry))) {
+            git_tree_entry_free(entry);
+            return;
+        }
+
+        git_tree_entry_free(entry);
+
+        if(git_blob_lookup(&newBlob, repo, &id)) {
+            git_blob_free(oldBlob);
+            return;
+        }
+
+        if(!git_patch_from_blobs(&patch, oldBlob, path.c_str(), newBlob, path.c_str(), &diffOptions)) {
+            readHunks(patch, hunks);
+            git_patch_free(patch);
+
+            mapUnchangedLines(hunks, parentOrigins.size(), origins.size(), [&](size_t o, size_t n) {
+                if(added[n]) {
+                    origins[n] = parentOrigins[o];
+                    added[n] = false;
+                }
+            });
+        }
+
+        git_blob_free(oldBlob);
+        git_blob_free(newBlob);
+    }
+};
+
+LineProvenance::LineProvenance(git_commit *head) : pImpl(new LineProvenanceImpl(head)) {
+}
+
+LineProvenance::~LineProvenance() {
+    delete pImpl;
+}
+
+int LineProvenance::commits() const {
+    return pImpl->commits.size();
+}
+
+void LineProvenance::walk(const Visitor& visitor) {
+    pImpl->walk(visitor);
+}
+
+}
@@ -1,6 +1,7 @@
 
 #include "Options.hh"
-#include <list>
+#include <unordered_map>
+#include <mutex>
 #include <unistd.h>
 #include <limits.h>
 #include <fstream>
@@ -15,88 +16,154 @@ GitStockOptions Options;
 
 namespace {
 GitStockOptions *__options = nullptr;
+
+string lowercase(const string& str) {
+    string lower(str);
+    for(char& c : lower) {
+        if(c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+    }
+
+    return lower;
+}
+
+string trim(const string& str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if(start == string::npos) {
+        return "";
+    }
+
+    return str.substr(start, str.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+//
+// Replacement for a commit email, optionally specialized by commit name.
+// Empty fields leave the corresponding part of the signature unchanged.
+//
+struct MailMapTarget {
+    string name;
+    string email;
+};
+
 struct MailMapEntry {
-    string srcName;
-    string srcEmail;
-    string destName;
-    string destEmail;
+    MailMapTarget target;
+    // lowercase commit name -> replacement
+    unordered_map<string, MailMapTarget> names;
 };
 
-vector<MailMapEntry*> mailmap;
-
-list<string> split(const string& str, const string& seps) {
-    int start = -1;
-    list<string> strs;
-    for(int i = 0; i < str.length(); ++i) {
-        char c = str[i];
-
-        if(seps.find(c) != string::npos) {
-            if(start >= 0) {
-                strs.push_back(str.substr(start, i));
-                start = -1;
-            } else {
-                start = i;
-            }
-        } else if(start < 0) {
-            start = i;
-        }
+//
+// The compiled mailmap, keyed on lowercase commit email. It is built once by
+// loadMailMap() and only read afterwards, so lookups need no locking.
+//
+unordered_map<string, MailMapEntry> mailmap;
+
+//
+// Resolved signatures, keyed on the raw "email\0name". Stripes keep worker
+// threads from serializing on a single lock.
+//
+const size_t MEMO_STRIPES = 16;
+
+struct ResolvedStripe {
+    mutex lock;
+    unordered_map<string, pair<string, string>> signatures;
+};
+
+ResolvedStripe resolved[MEMO_STRIPES];
+
+//
+// Parse "[name] <email>" starting at pos. Returns the position after the '>'
+// or string::npos if there is no email.
+//
+size_t parseNameAndEmail(const string& line, size_t pos, string& name, string& email) {
+    size_t open = line.find('<', pos);
+    if(open == string::npos) {
+        return string::npos;
     }
 
-    if(start >= 0) {
-        strs.push_back(str.substr(start));
+    size_t close = line.find('>', open);
+    if(close == string::npos) {
+        return string::npos;
     }
 
-    return strs;
+    name = trim(line.substr(pos, open - pos));
+    email = line.substr(open + 1, close - open - 1);
+    return close + 1;
+}
+
+void addMapping(const string& properName, const string& properEmail,
+                const string& commitName, const string& commitEmail) {
+    MailMapEntry& entry = mailmap[lowercase(commitEmail)];
+    MailMapTarget& target = commitName.empty() ? entry.target : entry.names[lowercase(commitName)];
+
+    // later lines override the fields they set, like git
+    if(!properName.empty()) {
+        target.name = properName;
+    }
+
+    if(!properEmail.empty()) {
+        target.email = properEmail;
+    }
 }
 
 void parseMailmap(const string& path) {
     //
-    // The mailmap file contains a list of items:
+    // The mailmap file contains one mapping per line, in one of these forms:
     //
-    // [Proper Name] <proper@email> [Commit Name] <commit@email
+    // Proper Name <commit@email>
+    // <proper@email> <commit@email>
+    // Proper Name <proper@email> <commit@email>
+    // Proper Name <proper@email> Commit Name <commit@email>
     //
     ifstream stream;
     stream.open(path, ios::in);
 
-    while(!stream.eof()) {
-        string line;
-        string srcName, srcEmail, destName, destEmail;
-        list<string> parts;
-
-        getline(stream, line);
-        parts = split(line, " \t\r\n");
-
-        for(string part : parts) {
-            if(part[0] == '<') {
-                int end = part.length() - 1;
-                if(part[end] == '>') {
-                    --end;
-                }
-
-                if(srcName.empty() && destEmail.empty()) {
-                    destEmail = part.substr(1, end);
-                } else {
-                    MailMapEntry *entry = new MailMapEntry();
-
-                    srcEmail = part.substr(1, end);
-
-                    entry->srcName = srcName;
-                    entry->srcEmail = srcEmail;
-                    entry->destName = destName;
-                    entry->destEmail = destEmail;
-
-                    mailmap.push_back(entry);
-                    break;
-                }
-            } else {
-                if(destName.empty() && destEmail.empty()) {
-                    destName = part;
-                } else {
-                    srcName = part;
-                }
-            }
+    string line;
+    while(getline(stream, line)) {
+        string name1, email1, name2, email2;
+
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t pos = parseNameAndEmail(line, 0, name1, email1);
+        if(pos == string::npos) {
+            continue;
+        }
+
+        if(parseNameAndEmail(line, pos, name2, email2) != string::npos) {
+            addMapping(name1, email1, name2, email2);
+        } else {
+            addMapping(name1, "", "", email1);
+        }
+    }
+}
+
+pair<string, string> lookupSignature(const string& email, const string& name) {
+    pair<string, string> sig(email, name);
+
+    auto entry = mailmap.find(lowercase(email));
+    if(entry == mailmap.end()) {
+        return sig;
+    }
+
+    const MailMapTarget *target = &entry->second.target;
+    if(!entry->second.names.empty()) {
+        auto named = entry->second.names.find(lowercase(name));
+        if(named != entry->second.names.end()) {
+            target = &named->second;
         }
     }
+
+    if(!target->email.empty()) {
+        sig.first = target->email;
+    }
+
+    if(!target->name.empty()) {
+        sig.second = target->name;
+    }
+
+    return sig;
 }
 
 }
@@ -133,6 +200,23 @@ void GitStockOptions::initialize() {
     Options.pretty = false;
     Options.history = false;
     Options.json = false;
+    Options.engine = ENGINE_BLAME;
+    Options.granularity = GRANULARITY_DAY;
+    Options.percentiles = false;
+    Options.maxMemory = 0;
+    Options.cacheSize = 0;
+    Options.mmapLimit = 0;
+    Options.writeBuffer = 4 << 20;
+    Options.fsync = FSYNC_NEVER;
+    Options.compression = COMPRESS_NONE;
+    Options.format = FORMAT_JSON;
+    Options.ordered = false;
+    Options.delta = false;
+    Options.keyframeInterval = 30;
+    Options.shardIndex = 0;
+    Options.shardCount = 1;
+    Options.merge = false;
+    Options.resume = false;
     Options.output = &cout;
 }
 /*
@@ -151,19 +235,28 @@ bool GitStockOptions::shouldIgnorePath(const string& path) const {
 }
 
 pair<string, string> GitStockOptions::resolveSignature(const string& email, const string& name) const {
-    if(useMailMapFile) {
-        for(auto entry : mailmap) {
-            if(entry->srcEmail == email) {
-                if(entry->destName.empty()) {
-                    entry->destName = name;
-                }
-
-                return make_pair(entry->destEmail, entry->destName);
-            }
+    if(!useMailMapFile || mailmap.empty()) {
+        return make_pair(email, name);
+    }
+
+    string key = email;
+    key += '\0';
+    key += name;
+
+    ResolvedStripe& stripe = resolved[hash<string>()(key) % MEMO_STRIPES];
+    {
+        unique_lock<mutex> lock(stripe.lock);
+        auto it = stripe.signatures.find(key);
+        if(it != stripe.signatures.end()) {
+            return it->second;
         }
     }
 
-    return make_pair(email, name);
+    pair<string, string> sig = lookupSignature(email, name);
+
+    unique_lock<mutex> lock(stripe.lock);
+    stripe.signatures[key] = sig;
+    return sig;
 }
 
 void GitStockOptions::loadMailMap(const string& path) {
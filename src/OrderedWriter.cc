@@ -0,0 +1,129 @@
+
+#include "OrderedWriter.hh"
+#include "JsonReport.hh"
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+struct PendingRecords {
+    const CommitDay *day;
+    string records;
+};
+
+}
+
+class OrderedWriterImpl {
+public:
+    JsonReport& report;
+    size_t count;
+    size_t window;
+    // sequence of the next snapshot to be written
+    size_t next;
+    bool cancelled;
+    unordered_map<size_t, PendingRecords> pending;
+    mutex writerMutex;
+    condition_variable submitted;
+    condition_variable written;
+    thread writer;
+
+    OrderedWriterImpl(JsonReport& report, size_t count, size_t window, size_t first)
+        : report(report), count(count), window(window), next(first), cancelled(false) {
+        writer = thread(&OrderedWriterImpl::run, this);
+    }
+
+    void submit(size_t sequence, const CommitDay *day, string& records) {
+        unique_lock<mutex> lock(writerMutex);
+
+        while(window && sequence >= next + window && !cancelled) {
+            written.wait(lock);
+        }
+
+        PendingRecords& entry = pending[sequence];
+        entry.day = day;
+        entry.records.swap(records);
+        if(sequence == next) {
+            submitted.notify_one();
+        }
+    }
+
+    bool canSubmit(size_t sequence) {
+        unique_lock<mutex> lock(writerMutex);
+        return !window || sequence < next + window || cancelled;
+    }
+
+    void run() {
+        unique_lock<mutex> lock(writerMutex);
+
+        while(next < count) {
+            auto it = pending.find(next);
+            if(it == pending.end()) {
+                if(cancelled) {
+                    break;
+                }
+
+                submitted.wait(lock);
+                continue;
+            }
+
+            const CommitDay *day = it->second.day;
+            string records;
+            records.swap(it->second.records);
+            pending.erase(it);
+            ++next;
+            written.notify_all();
+
+            // only this thread writes, so the stream lock is uncontended
+            lock.unlock();
+            report.write(records, day);
+            lock.lock();
+        }
+    }
+
+    void cancel() {
+        unique_lock<mutex> lock(writerMutex);
+        cancelled = true;
+        submitted.notify_one();
+        written.notify_all();
+    }
+
+    void close() {
+        if(writer.joinable()) {
+            writer.join();
+        }
+    }
+};
+
+OrderedWriter::OrderedWriter(JsonReport& report, size_t count, size_t window, size_t first)
+    : pImpl(new OrderedWriterImpl(report, count, window, first)) {
+}
+
+OrderedWriter::~OrderedWriter() {
+    pImpl->cancel();
+    pImpl->close();
+    delete pImpl;
+}
+
+void OrderedWriter::submit(size_t sequence, const CommitDay *day, string& records) {
+    pImpl->submit(sequence, day, records);
+}
+
+bool OrderedWriter::canSubmit(size_t sequence) {
+    return pImpl->canSubmit(sequence);
+}
+
+void OrderedWriter::cancel() {
+    pImpl->cancel();
+}
+
+void OrderedWriter::close() {
+    pImpl->close();
+}
+
+}
@@ -0,0 +1,456 @@
+
+#include "OutputWriter.hh"
+#include "CommitTimeline.hh"
+#include "Journal.hh"
+#include "FrameCompressor.hh"
+#include "TaskPool.hh"
+#include "GitStockLog.hh"
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+namespace gitstock {
+
+static GitStockLog logger = GitStockLog::getLogger();
+
+namespace {
+
+struct QueuedRecords {
+    string data;
+    // days whose records end in data
+    vector<const CommitDay*> days;
+    // size of the records before compression
+    size_t size;
+};
+
+// spent buffers kept for reuse by producers
+const size_t MAX_SPARE_BUFFERS = 64;
+
+// Records are compressed in frames of at least this size. Larger frames
+// compress slightly better but make seeking coarser.
+const size_t FRAME_SIZE = 1 << 20;
+
+}
+
+class OutputWriterImpl {
+public:
+    int fd;
+    size_t bufferSize;
+    FsyncPolicy fsync;
+    Journal *journal;
+    uint64_t offset;
+    FrameCompressor *compressor;
+    TaskPool *pool;
+    // producers wait while more than this is queued
+    size_t queueLimit;
+    deque<QueuedRecords> queue;
+    // records not written yet, in the open frame, being compressed or queued
+    size_t queuedBytes;
+    // frame being filled, and frames compressed but waiting for the ones
+    // before them
+    QueuedRecords frame;
+    map<size_t, QueuedRecords*> compressed;
+    size_t nextFrame;
+    size_t nextCompressed;
+    int compressing;
+    vector<string> spare;
+    bool closing;
+    atomic<bool> failed;
+    mutex queueMutex;
+    condition_variable queued;
+    condition_variable drained;
+    thread writer;
+
+    atomic<uint64_t> bytes;
+    atomic<uint64_t> recordBytes;
+    atomic<int64_t> writeTime;
+    atomic<int> stalls;
+
+    OutputWriterImpl(int fd, size_t bufferSize, FsyncPolicy fsync, Journal *journal,
+                     uint64_t offset, FrameCompressor *compressor, TaskPool *pool)
+        : fd(fd), bufferSize(bufferSize ? bufferSize : 1), fsync(fsync), journal(journal),
+        offset(offset), compressor(compressor), pool(pool), queuedBytes(0), nextFrame(0),
+        nextCompressed(0), compressing(0), closing(false), failed(false), bytes(0),
+        recordBytes(0), writeTime(0), stalls(0) {
+        queueLimit = this->bufferSize * 4;
+        if(compressor) {
+            queueLimit = max(queueLimit, FRAME_SIZE * 4);
+        }
+        frame.size = 0;
+
+        writer = thread(&OutputWriterImpl::run, this);
+    }
+
+    ~OutputWriterImpl() {
+        delete compressor;
+    }
+
+    void write(string& records, const CommitDay *day, bool wait) {
+        unique_lock<mutex> lock(queueMutex);
+        size_t size = records.size();
+
+        // nothing more reaches the output after a failure
+        if(failed) {
+            records.clear();
+            return;
+        }
+
+        if(wait) {
+            waitForRoom(lock, size);
+        }
+        queuedBytes += size;
+        recordBytes += size;
+
+        if(!compressor) {
+            queue.push_back(QueuedRecords());
+            queue.back().data.swap(records);
+            queue.back().days.push_back(day);
+            queue.back().size = size;
+            recycle(records);
+            queued.notify_one();
+            return;
+        }
+
+        // a day's records always end up in one frame
+        if(frame.data.empty()) {
+            frame.data.swap(records);
+            recycle(records);
+        } else {
+            frame.data.append(records);
+            records.clear();
+        }
+        frame.days.push_back(day);
+        frame.size += size;
+
+        if(frame.size >= FRAME_SIZE) {
+            seal(lock);
+        }
+    }
+
+    // hand a producer an empty buffer from the spares, if there are any
+    void recycle(string& records) {
+        if(!spare.empty()) {
+            records.swap(spare.back());
+            spare.pop_back();
+        }
+    }
+
+    void waitForRoom(unique_lock<mutex>& lock, size_t size) {
+        bool stalled = false;
+
+        while(queuedBytes && queuedBytes + size > queueLimit && !failed) {
+            // the open frame only drains once it's compressed
+            if(!frame.data.empty()) {
+                seal(lock);
+                continue;
+            }
+
+            if(!stalled) {
+                ++stalls;
+                stalled = true;
+            }
+
+            if(pool && TaskPool::currentWorker() >= 0) {
+                // frames are compressed on the pool, so help instead of
+                // blocking one of its threads
+                lock.unlock();
+                pool->helpUntil([this, size]() {
+                    unique_lock<mutex> lock(queueMutex);
+                    return !queuedBytes || queuedBytes + size <= queueLimit || failed;
+                });
+                lock.lock();
+            } else {
+                drained.wait(lock);
+            }
+        }
+    }
+
+    //
+    // Compress the open frame, on the pool if there is one and otherwise on
+    // this thread. Frames are queued for the writer in the order they were
+    // sealed.
+    //
+    void seal(unique_lock<mutex>& lock) {
+        QueuedRecords *sealed = new QueuedRecords();
+        size_t sequence = nextFrame++;
+
+        sealed->data.swap(frame.data);
+        sealed->days.swap(frame.days);
+        sealed->size = frame.size;
+        frame.size = 0;
+        ++compressing;
+
+        lock.unlock();
+        if(pool) {
+            pool->submit([this, sealed, sequence]() {
+                compress(sealed, sequence);
+            });
+        } else {
+            compress(sealed, sequence);
+        }
+        lock.lock();
+    }
+
+    void compress(QueuedRecords *sealed, size_t sequence) {
+        string data;
+        bool ok = compressor->compress(sealed->data.data(), sealed->data.size(), data);
+
+        unique_lock<mutex> lock(queueMutex);
+
+        if(!ok) {
+            logger.error() << "failed to compress output" << endlog;
+            fail();
+        }
+
+        if(spare.size() < MAX_SPARE_BUFFERS) {
+            sealed->data.clear();
+            spare.push_back(string());
+            spare.back().swap(sealed->data);
+        }
+        sealed->data.swap(data);
+        compressed[sequence] = sealed;
+
+        while(!compressed.empty() && compressed.begin()->first == nextCompressed) {
+            QueuedRecords *next = compressed.begin()->second;
+
+            queue.push_back(QueuedRecords());
+            queue.back().data.swap(next->data);
+            queue.back().days.swap(next->days);
+            queue.back().size = next->size;
+
+            compressed.erase(compressed.begin());
+            delete next;
+            ++nextCompressed;
+        }
+
+        --compressing;
+        queued.notify_one();
+    }
+
+    void run() {
+        vector<QueuedRecords> batch;
+
+        while(true) {
+            unique_lock<mutex> lock(queueMutex);
+
+            while(queue.empty() && !(closing && !compressing)) {
+                queued.wait(lock);
+            }
+
+            if(queue.empty()) {
+                break;
+            }
+
+            // coalesce queued buffers into one write of up to bufferSize
+            size_t size = 0;
+            do {
+                size += queue.front().data.size();
+                queuedBytes -= queue.front().size;
+                batch.push_back(QueuedRecords());
+                batch.back().data.swap(queue.front().data);
+                batch.back().days.swap(queue.front().days);
+                batch.back().size = queue.front().size;
+                queue.pop_front();
+            } while(!queue.empty() && batch.size() < IOV_MAX &&
+                    size + queue.front().data.size() <= bufferSize);
+
+            drained.notify_all();
+            lock.unlock();
+
+            writeBatch(batch);
+
+            lock.lock();
+            for(QueuedRecords& records : batch) {
+                if(spare.size() < MAX_SPARE_BUFFERS) {
+                    records.data.clear();
+                    spare.push_back(string());
+                    spare.back().swap(records.data);
+                }
+            }
+            batch.clear();
+        }
+
+        if(compressor) {
+            batch.push_back(QueuedRecords());
+            compressor->finish(batch.back().data);
+            batch.back().size = batch.back().data.size();
+            writeBatch(batch);
+        }
+
+        if(fsync == FSYNC_CLOSE && !failed) {
+            sync();
+        }
+    }
+
+    void writeBatch(vector<QueuedRecords>& batch) {
+        vector<iovec> iov;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        if(failed) {
+            return;
+        }
+
+        for(QueuedRecords& records : batch) {
+            if(!records.data.empty()) {
+                iovec v = { (void*)records.data.data(), records.data.size() };
+                iov.push_back(v);
+            }
+        }
+
+        if(!writeAll(iov)) {
+            logger.error() << "failed to write output: " << strerror(errno) << endlog;
+
+            unique_lock<mutex> lock(queueMutex);
+            fail();
+            return;
+        }
+
+        if(fsync == FSYNC_WRITE) {
+            sync();
+        }
+
+        writeTime += chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count();
+
+        // the days in this batch are now in the output
+        for(QueuedRecords& records : batch) {
+            offset += records.data.size();
+            bytes += records.data.size();
+
+            if(compressor && !records.days.empty()) {
+                compressor->written(records.size, records.data.size());
+            }
+
+            for(const CommitDay *day : records.days) {
+                if(journal && day) {
+                    journal->record(day->sequence(), day->timestamp(), offset);
+                }
+            }
+        }
+    }
+
+    // Drop what's queued and release waiting producers; nothing more is
+    // written. Called with queueMutex held.
+    void fail() {
+        failed = true;
+        for(QueuedRecords& records : queue) {
+            queuedBytes -= records.size;
+        }
+        queue.clear();
+        drained.notify_all();
+    }
+
+    bool writeAll(vector<iovec>& iov) {
+        size_t first = 0;
+
+        while(first < iov.size()) {
+            ssize_t n = writev(fd, &iov[first], iov.size() - first);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            // skip what was written, which may end inside a buffer
+            while(first < iov.size() && (size_t)n >= iov[first].iov_len) {
+                n -= iov[first].iov_len;
+                ++first;
+            }
+
+            if(first < iov.size()) {
+                iov[first].iov_base = (char*)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+
+        return true;
+    }
+
+    void sync() {
+        if(fdatasync(fd)) {
+            logger.error() << "failed to sync output: " << strerror(errno) << endlog;
+        }
+    }
+
+    bool close() {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            if(!frame.data.empty()) {
+                seal(lock);
+            }
+            closing = true;
+            queued.notify_one();
+        }
+
+        if(writer.joinable()) {
+            writer.join();
+        }
+
+        if(fd >= 0) {
+            if(::close(fd)) {
+                failed = true;
+            }
+            fd = -1;
+        }
+
+        return !failed;
+    }
+};
+
+OutputWriter::OutputWriter(int fd, size_t bufferSize, FsyncPolicy fsync, Journal *journal,
+                           uint64_t offset, FrameCompressor *compressor, TaskPool *pool)
+    : pImpl(new OutputWriterImpl(fd, bufferSize, fsync, journal, offset, compressor, pool)) {
+}
+
+OutputWriter::~OutputWriter() {
+    pImpl->close();
+    delete pImpl;
+}
+
+void OutputWriter::write(string& records, const CommitDay *day) {
+    pImpl->write(records, day, true);
+}
+
+void OutputWriter::writeNow(string& records) {
+    pImpl->write(records, nullptr, false);
+}
+
+bool OutputWriter::close() {
+    return pImpl->close();
+}
+
+bool OutputWriter::failed() const {
+    return pImpl->failed.load();
+}
+
+uint64_t OutputWriter::bytesWritten() const {
+    return pImpl->bytes.load();
+}
+
+uint64_t OutputWriter::recordBytes() const {
+    return pImpl->recordBytes.load();
+}
+
+int64_t OutputWriter::writeMicroseconds() const {
+    return pImpl->writeTime.load();
+}
+
+int OutputWriter::stalls() const {
+    return pImpl->stalls.load();
+}
+
+}
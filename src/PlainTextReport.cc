@@ -10,6 +10,21 @@ using namespace std;
 
 namespace gitstock {
 
+namespace {
+
+void reportPercentiles(ostream& os, const LineAgeMetrics& metrics, const mpz_class& offset) {
+    if(!metrics.hasLineAgePercentiles()) {
+        return;
+    }
+
+    os << "Median Line Age:              "
+            << formatDuration(metrics.lineAgePercentile(50, offset)) << "\n"
+        << "90th Percentile Line Age:     "
+            << formatDuration(metrics.lineAgePercentile(90, offset)) << "\n";
+}
+
+}
+
 PlainTextReport::PlainTextReport() {
 }
 
@@ -32,7 +47,9 @@ void PlainTextReport::report(const TreeMetrics& tree) {
             ) << "\n"
         << "Line Age Standard Deviation:  "
             << formatDuration(tree.lineAgeStandardDeviation(offset))
-            << "\n\n";
+            << "\n";
+    reportPercentiles(os, tree, offset);
+    os << "\n";
 
     os << "Stocks\n"
         << "=========================================================\n"
@@ -52,7 +69,9 @@ void PlainTextReport::report(const TreeMetrics& tree) {
             ) << "\n"
             << "Line Age Standard Deviation:  "
                 << formatDuration(stock->lineAgeStandardDeviation(offset))
-                << "\n\n";
+                << "\n";
+        reportPercentiles(os, *stock, offset);
+        os << "\n";
     }
 
     os << "Files\n"
@@ -78,8 +97,9 @@ void PlainTextReport::report(const TreeMetrics& tree) {
                 ) << "\n"
             << "Line Age Standard Deviation:  "
                 << formatDuration(file->lineAgeStandardDeviation(fileOffset))
-                << "\n"
-            << "Top 5 Contributors:           ";
+                << "\n";
+        reportPercentiles(os, *file, fileOffset);
+        os << "Top 5 Contributors:           ";
 
         for(Stock *stock : file->stocks()) {
             if(stockCount) {
@@ -0,0 +1,147 @@
+
+#include "ShardMerge.hh"
+#include <jsoncpp/json/json.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+// keys are written sorted, so a day record starts with its commit count
+const string DAY_RECORD_PREFIX = "{\"CommitCount\":";
+const string DAY_RECORD_SUFFIX = "\"_type\":\"commit-day\"}";
+
+bool isDayRecord(const string& line) {
+    return line.compare(0, DAY_RECORD_PREFIX.size(), DAY_RECORD_PREFIX) == 0 &&
+        line.size() >= DAY_RECORD_SUFFIX.size() &&
+        line.compare(line.size() - DAY_RECORD_SUFFIX.size(), DAY_RECORD_SUFFIX.size(),
+                     DAY_RECORD_SUFFIX) == 0;
+}
+
+struct ShardInput {
+    string path;
+    ifstream stream;
+    Json::Value header;
+    // first line of the next day, already read
+    string next;
+    bool hasNext;
+    size_t days;
+
+    ShardInput() : hasNext(false), days(0) {
+    }
+
+    bool readLine(string& line) {
+        return (bool)getline(stream, line);
+    }
+
+    bool open(const string& path) {
+        Json::CharReaderBuilder builder;
+        unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        string line;
+        string errors;
+
+        this->path = path;
+        stream.open(path.c_str());
+        if(!stream.good() || !readLine(line)) {
+            cerr << path << ": failed to read shard\n";
+            return false;
+        }
+
+        if(!reader->parse(line.data(), line.data() + line.size(), &header, &errors) ||
+           !header.isObject() || header["_type"].asString() != "shard") {
+            cerr << path << ": missing shard record\n";
+            return false;
+        }
+
+        hasNext = readLine(next);
+        return true;
+    }
+
+    // copy the next day's records to output
+    bool copyDay(ostream& output) {
+        if(!hasNext || !isDayRecord(next)) {
+            cerr << path << ": shard ends after " << days << " days\n";
+            return false;
+        }
+
+        do {
+            output << next << "\n";
+            hasNext = readLine(next);
+        } while(hasNext && !isDayRecord(next));
+
+        ++days;
+        return true;
+    }
+};
+
+}
+
+int mergeShards(const vector<string>& paths, ostream& output) {
+    vector<unique_ptr<ShardInput>> shards;
+    Json::Value first;
+    size_t count, totalDays;
+
+    if(paths.empty()) {
+        cerr << "no shards to merge\n";
+        return 1;
+    }
+
+    for(const string& path : paths) {
+        unique_ptr<ShardInput> shard(new ShardInput);
+        if(!shard->open(path)) {
+            return 1;
+        }
+
+        shards.push_back(std::move(shard));
+    }
+
+    first = shards[0]->header;
+    count = first["ShardCount"].asUInt();
+    totalDays = first["Days"].asUInt();
+
+    if(count != shards.size()) {
+        cerr << "expected " << count << " shards, got " << shards.size() << "\n";
+        return 1;
+    }
+
+    // put the shards in index order and check that they come from the same run
+    vector<ShardInput*> ordered(count, nullptr);
+    for(unique_ptr<ShardInput>& shard : shards) {
+        const Json::Value& header = shard->header;
+        size_t index = header["Shard"].asUInt();
+
+        if(header["ShardCount"].asUInt() != count || header["Days"].asUInt() != totalDays ||
+           header["Head"] != first["Head"] || header["Granularity"] != first["Granularity"]) {
+            cerr << shard->path << ": shard is from a different run than " << paths[0] << "\n";
+            return 1;
+        }
+
+        if(index < 1 || index > count || ordered[index - 1]) {
+            cerr << shard->path << ": invalid or duplicate shard " << index << "\n";
+            return 1;
+        }
+
+        ordered[index - 1] = shard.get();
+    }
+
+    for(size_t day = 0; day < totalDays; ++day) {
+        if(!ordered[day % count]->copyDay(output)) {
+            return 1;
+        }
+    }
+
+    for(ShardInput *shard : ordered) {
+        if(shard->hasNext) {
+            cerr << shard->path << ": unexpected records after " << shard->days << " days\n";
+            return 1;
+        }
+    }
+
+    return output.good() ? 0 : 1;
+}
+
+}
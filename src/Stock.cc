@@ -1,6 +1,7 @@
 
 #include "Stock.hh"
 #include "Options.hh"
+#include "AuthorTable.hh"
 
 using namespace std;
 
@@ -18,31 +19,42 @@ struct StockPtrSorter {
 
 class StockImpl {
 public:
-    string email;
-    string name;
+    uint32_t author;
     double ownership;
 
-    StockImpl(const git_signature *sig)
-        : email(sig->email), name(sig->name), ownership(0) {
-    }
-
-    StockImpl(const string& email, const string& name)
-        : email(email), name(name) {
+    StockImpl(uint32_t author) : author(author), ownership(0) {
     }
 };
 
 Stock::Stock(const git_signature *sig)
-    : LineAgeMetrics(), pImpl(new StockImpl(sig)) {
+    : LineAgeMetrics(), pImpl(new StockImpl(AuthorTable::get().intern(sig->email, sig->name))) {
 }
 
 Stock::Stock(const string& email, const string& name)
-    : LineAgeMetrics(), pImpl(new StockImpl(email, name)) {
+    : LineAgeMetrics(), pImpl(new StockImpl(AuthorTable::get().intern(email, name))) {
+}
+
+Stock::Stock(uint32_t author)
+    : LineAgeMetrics(), pImpl(new StockImpl(author)) {
+}
+
+Stock::Stock(const Stock& other)
+    : LineAgeMetrics(other), pImpl(new StockImpl(*other.pImpl)) {
 }
 
 Stock::~Stock() {
     delete pImpl;
 }
 
+Stock& Stock::operator=(const Stock& other) {
+    if(this != &other) {
+        LineAgeMetrics::operator=(other);
+        *pImpl = *other.pImpl;
+    }
+
+    return *this;
+}
+
 double Stock::ownership() const {
     return pImpl->ownership;
 }
@@ -51,17 +63,20 @@ void Stock::calculateOwnership(int totalLineCount) {
     pImpl->ownership = lineCount().get_d() / (double)totalLineCount;
 }
 
+uint32_t Stock::author() const {
+    return pImpl->author;
+}
 
 const string& Stock::email() const {
-    return pImpl->email;
+    return AuthorTable::get().email(pImpl->author);
 }
 
 const string& Stock::name() const {
-    return pImpl->name;
+    return AuthorTable::get().name(pImpl->author);
 }
 
 string Stock::toString() const {
-    return pImpl->name + " <" + pImpl->email + ">";
+    return name() + " <" + email() + ">";
 }
 
 void Stock::update(const Stock& other) {
@@ -72,8 +87,8 @@ Json::Value Stock::toJson(const mpz_class& offset) const {
     Json::Value json;
 
     LineAgeMetrics::toJson(json, offset);
-    json["AuthorName"] = pImpl->name;
-    json["AuthorEmail"] = pImpl->email;
+    json["AuthorName"] = name();
+    json["AuthorEmail"] = email();
     json["Ownership"] = pImpl->ownership;
     json["_type"] = "stock";
 
@@ -87,58 +102,119 @@ ostream& operator<<(ostream& os, const Stock& stock) {
 
 ///////////////////////////////////////////////////////////////
 
+//
+// Stocks are kept in a vector for iteration and indexed by author id in a
+// small open addressing hash table, which stores the vector index + 1 (0 marks
+// an empty slot).
+//
 class StockCollectionImpl {
 public:
     vector<Stock*> collection;
+    vector<uint32_t> slots;
 
-    Stock& find(const string& email, const string& name) {
-        Stock *stock = nullptr;
-        pair<string, string> resolved = Options.resolveSignature(email, name);
+    ~StockCollectionImpl() {
+        for(Stock *stock : collection) {
+            delete stock;
+        }
+    }
 
-        for(auto i = collection.begin(); i != collection.end() && !stock; ++i) {
-            if((*i)->email() == resolved.first) {
-                stock = *i;
+    static size_t hash(uint32_t author) {
+        return author * 2654435761u;
+    }
+
+    Stock& find(uint32_t author) {
+        size_t mask = slots.size() - 1;
+
+        if(!slots.empty()) {
+            for(size_t i = hash(author) & mask; slots[i]; i = (i + 1) & mask) {
+                Stock *stock = collection[slots[i] - 1];
+                if(stock->author() == author) {
+                    return *stock;
+                }
             }
         }
 
-        if(!stock) {
-            stock = new Stock(resolved.first, resolved.second);
-            collection.push_back(stock);
-        }
+        Stock *stock = new Stock(author);
+        collection.push_back(stock);
+        reindex();
 
         return *stock;
     }
 
-    ~StockCollectionImpl() {
-        for(Stock *stock : collection) {
-            delete stock;
+    void reindex() {
+        // keep the table at most half full
+        if(collection.size() * 2 <= slots.size()) {
+            insertSlot(collection.size() - 1);
+        } else {
+            rebuild(slots.empty() ? 8 : slots.size() * 2);
+        }
+    }
+
+    void rebuild(size_t capacity) {
+        slots.assign(capacity, 0);
+        for(size_t i = 0; i < collection.size(); ++i) {
+            insertSlot(i);
         }
     }
 
+    void insertSlot(size_t index) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(collection[index]->author()) & mask;
+
+        while(slots[i]) {
+            i = (i + 1) & mask;
+        }
+
+        slots[i] = index + 1;
+    }
+
     void update(const StockCollectionImpl& other) {
         for(Stock *stock : other.collection) {
-            find(stock->email(), stock->name()).update(*stock);
+            find(stock->author()).update(*stock);
         }
     }
 
     void sort() {
         std::sort(collection.begin(), collection.end(), StockPtrSorter());
+        rebuild(slots.size());
     }
 };
 
 StockCollection::StockCollection() : pImpl(new StockCollectionImpl) {
 }
 
+StockCollection::StockCollection(const StockCollection& other)
+    : pImpl(new StockCollectionImpl) {
+    for(const Stock *stock : other) {
+        pImpl->collection.push_back(new Stock(*stock));
+    }
+
+    pImpl->rebuild(other.pImpl->slots.size());
+}
+
 StockCollection::~StockCollection() {
     delete pImpl;
 }
 
+StockCollection& StockCollection::operator=(const StockCollection& other) {
+    if(this != &other) {
+        StockCollection copy(other);
+        std::swap(pImpl, copy.pImpl);
+    }
+
+    return *this;
+}
+
 Stock& StockCollection::find(const git_signature *sig) {
-    return pImpl->find(sig->email, sig->name);
+    return pImpl->find(AuthorTable::get().intern(sig->email, sig->name));
+}
+
+Stock& StockCollection::find(uint32_t author) {
+    return pImpl->find(author);
 }
 
 Stock& StockCollection::find(const Stock& stock) {
-    return pImpl->find(stock.email(), stock.name());
+    return pImpl->find(stock.author());
 }
 
 int StockCollection::count() const {
@@ -0,0 +1,276 @@
+
+#include "TaskPool.hh"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+namespace gitstock {
+
+namespace {
+
+struct WorkerQueue {
+    mutex queueMutex;
+    deque<TaskPool::Task> tasks;
+};
+
+// pool and index of the worker running on this thread
+thread_local TaskPoolImpl *currentPool = nullptr;
+thread_local int currentIndex = -1;
+// time the task running on this thread spent in helpUntil(), which is
+// counted by the tasks run there or not at all
+thread_local int64_t helpedMicroseconds = 0;
+
+int64_t microsecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - start).count();
+}
+
+}
+
+class TaskPoolImpl {
+public:
+    vector<WorkerQueue*> queues;
+    // tasks submitted from outside the pool
+    WorkerQueue shared;
+    vector<thread> workers;
+    // queued tasks, raised under sleepMutex so that sleepers can't miss one;
+    // briefly negative when a task is taken before it's counted
+    atomic<int64_t> pending;
+    // submitted tasks that haven't finished yet
+    atomic<size_t> outstanding;
+    // threads in helpUntil() or wait()
+    atomic<int> waiters;
+    atomic<int64_t> busy;
+    bool stopping;
+    mutex sleepMutex;
+    condition_variable queued;
+    condition_variable finished;
+
+    TaskPoolImpl(int threads) : pending(0), outstanding(0), waiters(0), busy(0), stopping(false) {
+        for(int i = 0; i < threads; ++i) {
+            queues.push_back(new WorkerQueue);
+        }
+
+        for(int i = 0; i < threads; ++i) {
+            workers.push_back(thread(&TaskPoolImpl::run, this, i));
+        }
+    }
+
+    ~TaskPoolImpl() {
+        wait();
+
+        {
+            unique_lock<mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        queued.notify_all();
+
+        for(thread& t : workers) {
+            t.join();
+        }
+
+        for(WorkerQueue *queue : queues) {
+            delete queue;
+        }
+    }
+
+    void submit(const TaskPool::Task& task) {
+        WorkerQueue& queue = currentPool == this ? *queues[currentIndex] : shared;
+
+        ++outstanding;
+        {
+            unique_lock<mutex> lock(queue.queueMutex);
+            queue.tasks.push_back(task);
+        }
+
+        {
+            unique_lock<mutex> lock(sleepMutex);
+            ++pending;
+        }
+        queued.notify_one();
+    }
+
+    bool take(TaskPool::Task& task) {
+        int self = currentPool == this ? currentIndex : -1;
+
+        if(self >= 0 && popBack(*queues[self], task)) {
+            return true;
+        }
+
+        if(popFront(shared, task)) {
+            return true;
+        }
+
+        // steal, starting after ourselves so that thieves spread out
+        for(size_t i = 1; i <= queues.size(); ++i) {
+            size_t victim = (self + i) % queues.size();
+            if((int)victim != self && popFront(*queues[victim], task)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool popBack(WorkerQueue& queue, TaskPool::Task& task) {
+        unique_lock<mutex> lock(queue.queueMutex);
+
+        if(queue.tasks.empty()) {
+            return false;
+        }
+
+        task.swap(queue.tasks.back());
+        queue.tasks.pop_back();
+        --pending;
+        return true;
+    }
+
+    bool popFront(WorkerQueue& queue, TaskPool::Task& task) {
+        unique_lock<mutex> lock(queue.queueMutex);
+
+        if(queue.tasks.empty()) {
+            return false;
+        }
+
+        task.swap(queue.tasks.front());
+        queue.tasks.pop_front();
+        --pending;
+        return true;
+    }
+
+    void execute(TaskPool::Task& task) {
+        int64_t outerHelped = helpedMicroseconds;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        helpedMicroseconds = 0;
+        task();
+        task = nullptr;
+
+        busy += microsecondsSince(start) - helpedMicroseconds;
+        helpedMicroseconds = outerHelped;
+
+        // wake waiters whose condition may depend on this task
+        if(--outstanding == 0 || waiters.load()) {
+            unique_lock<mutex> lock(sleepMutex);
+            finished.notify_all();
+        }
+    }
+
+    void run(int index) {
+        TaskPool::Task task;
+
+        currentPool = this;
+        currentIndex = index;
+
+        while(true) {
+            if(take(task)) {
+                execute(task);
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            while(!stopping && pending.load() <= 0) {
+                queued.wait(lock);
+            }
+
+            if(stopping && pending.load() <= 0) {
+                break;
+            }
+        }
+    }
+
+    void helpUntil(const function<bool()>& done) {
+        bool worker = currentPool == this;
+        TaskPool::Task task;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        ++waiters;
+        while(!done()) {
+            if(worker && take(task)) {
+                execute(task);
+                continue;
+            }
+
+            // conditions can also change outside the pool, so wake up now
+            // and then even if no task finishes
+            unique_lock<mutex> lock(sleepMutex);
+            if(!worker || pending.load() <= 0) {
+                finished.wait_for(lock, chrono::milliseconds(10));
+            }
+        }
+        --waiters;
+
+        helpedMicroseconds += microsecondsSince(start);
+    }
+
+    void wait() {
+        unique_lock<mutex> lock(sleepMutex);
+
+        ++waiters;
+        while(outstanding.load()) {
+            finished.wait(lock);
+        }
+        --waiters;
+    }
+};
+
+TaskPool::TaskPool(int threads) : pImpl(new TaskPoolImpl(threads > 0 ? threads : 1)) {
+}
+
+TaskPool::~TaskPool() {
+    delete pImpl;
+}
+
+int TaskPool::threads() const {
+    return pImpl->queues.size();
+}
+
+void TaskPool::submit(const Task& task) {
+    pImpl->submit(task);
+}
+
+void TaskPool::parallel(size_t count, const function<void(size_t)>& task,
+                        const Task& continuation) {
+    if(!count) {
+        submit(continuation);
+        return;
+    }
+
+    shared_ptr<atomic<size_t>> remaining(new atomic<size_t>(count));
+    shared_ptr<function<void(size_t)>> shared(new function<void(size_t)>(task));
+    shared_ptr<Task> then(new Task(continuation));
+
+    for(size_t i = 0; i < count; ++i) {
+        submit([=]() {
+            (*shared)(i);
+            if(--*remaining == 0) {
+                (*then)();
+            }
+        });
+    }
+}
+
+void TaskPool::helpUntil(const function<bool()>& done) {
+    pImpl->helpUntil(done);
+}
+
+void TaskPool::wait() {
+    pImpl->wait();
+}
+
+int64_t TaskPool::busyMicroseconds() const {
+    return pImpl->busy.load();
+}
+
+int TaskPool::currentWorker() {
+    return currentIndex;
+}
+
+}
@@ -4,23 +4,46 @@
 #include "Stock.hh"
 #include "util.hh"
 #include "Options.hh"
+#include "BlameCache.hh"
+#include "LineProvenance.hh"
+#include "TaskPool.hh"
 #include <string>
 #include <iostream>
 #include <git2/blob.h>
+#include <git2/odb.h>
+#include <git2/repository.h>
+#include <algorithm>
+#include <atomic>
 
 using namespace std;
 
 
 namespace gitstock {
 
-struct TreeWalkState {
-    const git_tree *tree;
-    const git_commit *newestCommit;
-    TreeMetricsImpl *pImpl;
+namespace {
+
+struct TreeFile {
+    string path;
+    git_oid blob;
+    git_filemode_t mode;
+    size_t size;
 };
 
+struct TreeFileSizeSorter {
+    const vector<TreeFile>& files;
+
+    TreeFileSizeSorter(const vector<TreeFile>& files) : files(files) {
+    }
+
+    bool operator() (size_t i, size_t j) const {
+        return files[i].size > files[j].size;
+    }
+};
+
+}
 
 int treeMetricsCallback(const char *root, const git_tree_entry *entry, void *payload);
+bool isTextBlob(git_repository *repo, const git_oid *id, git_filemode_t mode);
 
 
 class TreeMetricsImpl {
@@ -33,23 +56,32 @@ public:
     string path;
     int64_t timestamp;
 
-    TreeMetricsImpl(LineAgeMetrics& lineMetrics, const string& path, const git_tree *tree, const git_commit *newestCommit)
-        : lineMetrics(lineMetrics), fileCount(0), path(path) {
-
-        TreeWalkState state;
-        git_repository *repo = git_tree_owner(tree);
-        state.tree = tree;
-        state.newestCommit = newestCommit;
-        state.pImpl = this;
+    const git_tree *tree;
+    const git_commit *newestCommit;
+    BlameCache *cache;
+    // position of the snapshot in the timeline, for the cache
+    size_t sequence;
+    const ProvenanceSnapshot *provenance;
+    vector<TreeFile> treeFiles;
+
+    // state of an analysis in progress
+    vector<FileMetrics*> results;
+    vector<size_t> order;
+    vector<LineAgeMetrics> partialLines;
+    vector<StockCollection> partialStocks;
+    atomic<size_t> next;
+
+    TreeMetricsImpl(LineAgeMetrics& lineMetrics, const string& path, const git_tree *tree,
+                    const git_commit *newestCommit, BlameCache *cache, size_t sequence,
+                    const ProvenanceSnapshot *provenance)
+        : lineMetrics(lineMetrics), fileCount(0), path(path), tree(tree),
+        newestCommit(newestCommit), cache(cache), sequence(sequence), provenance(provenance),
+        next(0) {
 
         name = basename(path.c_str());
-
-        git_tree_walk(tree, GIT_TREEWALK_PRE, treeMetricsCallback, &state);
-
-        stocks.calculateOwnership(lineMetrics.lineCount().get_si());
-        stocks.sort();
-
         timestamp = newestCommit ? getDayTimestamp(newestCommit) : 0;
+
+        git_tree_walk(tree, GIT_TREEWALK_PRE, treeMetricsCallback, this);
     }
 
     ~TreeMetricsImpl() {
@@ -58,19 +90,218 @@ public:
         }
     }
 
-    void update(FileMetrics *metrics) {
-        ++fileCount;
-        files.push_back(metrics);
-        lineMetrics.updateLineAgeMetrics(*metrics);
+    void addTreeFile(const string& path, const git_tree_entry *entry) {
+        TreeFile file;
+        file.path = path;
+        git_oid_cpy(&file.blob, git_tree_entry_id(entry));
+        file.mode = git_tree_entry_filemode(entry);
+        file.size = 0;
+        treeFiles.push_back(file);
+    }
+
+    //
+    // Blame every collected file, as tasks on pool if there is one, and call
+    // done once the metrics are complete. Up to one runner task per pool
+    // thread takes files from a shared index, largest files first so that a
+    // single huge file doesn't form the tail of the tree. Idle threads steal
+    // runners of other trees, so a tree that is processed on its own still
+    // uses the whole pool. Each runner accumulates its own partial line
+    // metrics and stocks, which are reduced once all files are done.
+    // Ownership is only calculated on the final totals.
+    //
+    void analyze(TaskPool *pool, const TaskPool::Task& done) {
+        size_t runners = pool ? min((size_t)pool->threads(), treeFiles.size()) : 1;
+
+        runners = max(runners, (size_t)1);
+        results.assign(treeFiles.size(), nullptr);
+        order.resize(treeFiles.size());
+        partialLines.resize(runners);
+        partialStocks.resize(runners);
+
+        for(size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+
+        if(runners > 1) {
+            readSizes();
+            stable_sort(order.begin(), order.end(), TreeFileSizeSorter(treeFiles));
+        }
+
+        if(!pool) {
+            analyzeWorker(0);
+            finish();
+            done();
+            return;
+        }
+
+        pool->parallel(runners, [this](size_t runner) {
+            analyzeWorker(runner);
+        }, [this, pool, done]() {
+            reduce(*pool, 1, [this, done]() {
+                finish();
+                done();
+            });
+        });
+    }
+
+    void analyzeWorker(size_t runner) {
+        LineAgeMetrics& lines = partialLines[runner];
+        StockCollection& runnerStocks = partialStocks[runner];
+        size_t i;
+
+        while((i = next++) < order.size()) {
+            FileMetrics *metrics = analyzeFile(treeFiles[order[i]]);
+            if(metrics) {
+                lines.updateLineAgeMetrics(*metrics);
+                runnerStocks.update(metrics->stocks());
+                results[order[i]] = metrics;
+            }
+        }
+    }
 
-        stocks.update(metrics->stocks());
-        stocks.calculateOwnership(metrics->lineCount().get_si());
+    //
+    // Pairwise tree reduction of the partial results into index 0. Each round
+    // halves the number of partials and the merges within a round are tasks
+    // that run in parallel, so the cost is log2(runners) merges of at most one
+    // collection per distinct author.
+    //
+    void reduce(TaskPool& pool, size_t stride, const TaskPool::Task& done) {
+        size_t count = partialLines.size();
+
+        if(stride >= count) {
+            done();
+            return;
+        }
+
+        pool.parallel((count - stride + stride * 2 - 1) / (stride * 2), [this, stride](size_t pair) {
+            size_t i = pair * stride * 2;
+            reducePair(partialLines[i], partialStocks[i], partialLines[i + stride],
+                       partialStocks[i + stride]);
+        }, [this, &pool, stride, done]() {
+            reduce(pool, stride * 2, done);
+        });
+    }
+
+    static void reducePair(LineAgeMetrics& lines, StockCollection& stocks,
+                           const LineAgeMetrics& otherLines, const StockCollection& otherStocks) {
+        lines.updateLineAgeMetrics(otherLines);
+        stocks.update(otherStocks);
+    }
+
+    void finish() {
+        lineMetrics.updateLineAgeMetrics(partialLines[0]);
+        stocks.update(partialStocks[0]);
+
+        // keep the tree walk order in the report
+        for(FileMetrics *metrics : results) {
+            if(metrics) {
+                files.push_back(metrics);
+            }
+        }
+
+        fileCount = files.size();
+
+        treeFiles.clear();
+        results.clear();
+        order.clear();
+        partialLines.clear();
+        partialStocks.clear();
+
+        stocks.calculateOwnership(lineMetrics.lineCount().get_si());
+        stocks.sort();
+    }
+
+    FileMetrics* analyzeFile(const TreeFile& file) {
+        FileMetrics *metrics = nullptr;
+
+        if(provenance) {
+            // the provenance engine only tracks text files
+            const LineOrigins *origins = provenance->find(file.path);
+            if(origins && file.mode == GIT_FILEMODE_BLOB) {
+                metrics = new FileMetrics(file.path, *origins);
+            }
+
+            return metrics;
+        }
+
+        if(!cache || !cache->find(sequence, file.path, &file.blob, &metrics)) {
+            if(isTextBlob(git_tree_owner(tree), &file.blob, file.mode)) {
+                metrics = new FileMetrics(tree, file.path, newestCommit);
+            }
+
+            if(cache) {
+                cache->insert(sequence, file.path, &file.blob, metrics);
+            }
+        }
+
+        return metrics;
+    }
+
+    void readSizes() {
+        git_odb *odb;
+        size_t size;
+        git_otype type;
+
+        if(git_repository_odb(&odb, git_tree_owner(tree))) {
+            return;
+        }
+
+        // reading the object header is much cheaper than loading the blob
+        for(TreeFile& file : treeFiles) {
+            if(!git_odb_read_header(&size, &type, odb, &file.blob)) {
+                file.size = size;
+            }
+        }
+
+        git_odb_free(odb);
     }
 };
 
-TreeMetrics::TreeMetrics(const string& path, const git_tree *tree, const git_commit *newestCommit)
-    : LineAgeMetrics(), pImpl(new TreeMetricsImpl(*this, path, tree, newestCommit)) {
+TreeMetrics::TreeMetrics(const string& path, const git_tree *tree, const git_commit *newestCommit,
+                         TaskPool *pool)
+    : LineAgeMetrics(),
+    pImpl(new TreeMetricsImpl(*this, path, tree, newestCommit, nullptr, 0, nullptr)) {
+
+    if(pool) {
+        atomic<bool> done(false);
+
+        pImpl->analyze(pool, [&done]() {
+            done = true;
+        });
+        pool->helpUntil([&done]() {
+            return done.load();
+        });
+    } else {
+        pImpl->analyze(nullptr, []() {
+        });
+    }
+}
+
+TreeMetrics::TreeMetrics(const string& path, const git_tree *tree,
+                         const ProvenanceSnapshot& provenance, const git_commit *newestCommit)
+    : LineAgeMetrics(),
+    pImpl(new TreeMetricsImpl(*this, path, tree, newestCommit, nullptr, 0, &provenance)) {
 
+    pImpl->analyze(nullptr, []() {
+    });
+}
+
+TreeMetrics::TreeMetrics(Deferred, const string& path, const git_tree *tree,
+                         const git_commit *newestCommit, BlameCache *cache, size_t sequence)
+    : LineAgeMetrics(),
+    pImpl(new TreeMetricsImpl(*this, path, tree, newestCommit, cache, sequence, nullptr)) {
+
+}
+
+void TreeMetrics::analyze(const string& path, const git_tree *tree,
+                          const git_commit *newestCommit, BlameCache *cache,
+                          size_t sequence, TaskPool& pool,
+                          const function<void(TreeMetrics*)>& done) {
+    TreeMetrics *metrics = new TreeMetrics(Deferred(), path, tree, newestCommit, cache, sequence);
+
+    metrics->pImpl->analyze(&pool, [metrics, done]() {
+        done(metrics);
+    });
 }
 
 TreeMetrics::~TreeMetrics() {
@@ -94,14 +325,13 @@ const StockCollection& TreeMetrics::stocks() const {
 }
 
 
-bool isTextBlob(git_repository *repo, const git_tree_entry *entry) {
+bool isTextBlob(git_repository *repo, const git_oid *id, git_filemode_t mode) {
 	git_blob *blob;
-	int rc = git_blob_lookup(&blob, repo, git_tree_entry_id(entry));
+	int rc = git_blob_lookup(&blob, repo, id);
 	bool isText = false;
 
 	if(!rc) {
-		isText = (!git_blob_is_binary(blob) &&
-				  git_tree_entry_filemode(entry) == GIT_FILEMODE_BLOB);
+		isText = (!git_blob_is_binary(blob) && mode == GIT_FILEMODE_BLOB);
 		git_blob_free(blob);
 	}
 
@@ -110,16 +340,15 @@ bool isTextBlob(git_repository *repo, const git_tree_entry *entry) {
 
 int treeMetricsCallback(const char *root, const git_tree_entry *entry, void *payload) {
     if(git_tree_entry_type(entry) == GIT_OBJ_BLOB) {
-        TreeWalkState *state = (TreeWalkState*)payload;
+        TreeMetricsImpl *pImpl = (TreeMetricsImpl*)payload;
 
         string path = root;
 
 		path += git_tree_entry_name(entry);
 
-        if(!Options.shouldIgnorePath(path) && isTextBlob(git_tree_owner(state->tree), entry)) {
-			FileMetrics *metrics = new FileMetrics(state->tree, path, state->newestCommit);
-			state->pImpl->update(metrics);
-		}
+        if(!Options.shouldIgnorePath(path)) {
+            pImpl->addTreeFile(path, entry);
+        }
     }
 
     return 0;
@@ -137,6 +366,10 @@ int64_t TreeMetrics::timestamp() const {
     return pImpl->timestamp;
 }
 
+void TreeMetrics::timestamp(int64_t timestamp) {
+    pImpl->timestamp = timestamp;
+}
+
 Json::Value TreeMetrics::toJson(const mpz_class& offset) const {
     Json::Value json;
     LineAgeMetrics::toJson(json, offset);
@@ -9,6 +9,15 @@
 #include "GitStockLog.hh"
 #include "GitStockProgress.hh"
 #include "JsonReport.hh"
+#include "BlameCache.hh"
+#include "LineProvenance.hh"
+#include "OrderedWriter.hh"
+#include "ShardMerge.hh"
+#include "Journal.hh"
+#include "TaskPool.hh"
+#include "OutputWriter.hh"
+#include "FrameCompressor.hh"
+#include "ColumnarWriter.hh"
 #include <atomic>
 #include <git2.h>
 #include <fstream>
@@ -16,8 +25,18 @@
 #include <limits.h>
 #include <signal.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <iomanip>
+#include <unordered_map>
 #include <getopt.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
 
 using namespace std;
 using namespace gitstock;
@@ -26,6 +45,102 @@ using namespace gitstock;
 static atomic_bool running(true);
 static GitStockLog logger = GitStockLog::getLogger();
 static GitStockProgress *progress = nullptr;
+// checkpoint journal of a history run written to a file
+static Journal *journal = nullptr;
+// writer stage of a history run written to a file
+static OutputWriter *output = nullptr;
+// renders the records of a columnar history run
+static ColumnarWriter *columnar = nullptr;
+// git directory of the repository, opened again by every history worker
+static string gitDirectory;
+
+//
+// Keeps history days within Options.maxMemory. A day about to start waits
+// while the process is over budget and other days are still in flight, since
+// finishing those frees their metrics. A pool thread keeps running the pool's
+// other tasks while it waits, which is what finishes those days.
+//
+// Crossing the budget drops the blame cache, as it is the only memory that
+// can be shed without losing work, and hands the freed heap back to the
+// system: glibc would keep it, and the resident size would stay over budget
+// for the rest of the run. The budget only counts as crossed again once the
+// process is back under 90% of it. A day never waits when nothing else is
+// running, so the run always makes progress even if the budget can't be met.
+//
+class MemoryGate {
+public:
+    // cache and pool are optional
+    MemoryGate(BlameCache *cache, TaskPool *pool)
+        : cache(cache), pool(pool), active(0), waits(0), crossings(0), over(false) {
+    }
+
+    void enter() {
+        if(Options.maxMemory && isOverBudget()) {
+            auto ready = [this]() {
+                return active.load() == 0 || !running.load() || !isOverBudget();
+            };
+
+            ++waits;
+            if(pool) {
+                pool->helpUntil(ready);
+            } else {
+                while(!ready()) {
+                    this_thread::sleep_for(chrono::milliseconds(10));
+                }
+            }
+        }
+
+        ++active;
+    }
+
+    void leave() {
+        --active;
+
+        // what the day freed only shows in the resident size once trimmed
+        if(over.load()) {
+            malloc_trim(0);
+        }
+    }
+
+    int waitCount() const {
+        return waits.load();
+    }
+
+    int crossingCount() const {
+        return crossings.load();
+    }
+
+private:
+    bool isOverBudget() {
+        uint64_t resident = getResidentMemory();
+
+        if(resident <= Options.maxMemory) {
+            if(resident <= Options.maxMemory / 10 * 9) {
+                over.store(false);
+            }
+            return false;
+        }
+
+        if(!over.exchange(true)) {
+            ++crossings;
+            if(cache) {
+                cache->clear();
+            }
+            malloc_trim(0);
+            resident = getResidentMemory();
+        }
+
+        return resident > Options.maxMemory;
+    }
+
+    BlameCache *cache;
+    TaskPool *pool;
+    atomic<int> active;
+    atomic<int> waits;
+    atomic<int> crossings;
+    // crossed the budget and not yet back under 90% of it
+    atomic<bool> over;
+};
 
 
 static void printUsage(const string& app) {
@@ -39,6 +154,46 @@ static void printUsage(const string& app) {
 		<< " --exclude=<pattern>        Exclude file <pattern> from processing.\n"
 		<< "                            Can be specified multiple times.\n"
         << " -t, --threads=<N>          Spawn N number of threads (default: 4)\n"
+		<< " --engine=<engine>          Line attribution engine: blame (default) or\n"
+		<< "                            provenance, which walks history once for\n"
+		<< "                            the whole tree.\n"
+		<< " --percentiles              Report median and 90th percentile line\n"
+		<< "                            ages.\n"
+		<< " --granularity=<unit>       History snapshot interval: commit, day\n"
+		<< "                            (default), week, month, tag or adaptive.\n"
+		<< " --max-memory=<size>        Resident memory budget for history mode,\n"
+		<< "                            e.g. 512M or 16G. Workers wait and the\n"
+		<< "                            blame cache is dropped when exceeded.\n"
+		<< " --cache-size=<size>        libgit2 object cache size, e.g. 1G.\n"
+		<< "                            Default: sized from the packs and the\n"
+		<< "                            available memory.\n"
+		<< " --mmap-limit=<size>        Limit on memory mapped pack data.\n"
+		<< "                            Default: at least the size of the packs.\n"
+		<< " --write-buffer=<size>      Largest single write of history output\n"
+		<< "                            to a file (default: 4M).\n"
+		<< " --fsync=<policy>           Sync history output to disk: never\n"
+		<< "                            (default), write (after every write) or\n"
+		<< "                            close.\n"
+		<< " --format=<format>          History output format: json (default) or\n"
+		<< "                            columnar, a memory mappable binary format\n"
+		<< "                            read by git-stock-query.\n"
+		<< " --compress=<format>        Compress history output: none, gzip or\n"
+		<< "                            zstd. Default: from the output file's\n"
+		<< "                            extension, .gz or .zst.\n"
+		<< " --ordered                  Write history records oldest first, in the\n"
+		<< "                            same order on every run.\n"
+		<< " --delta[=<N>]              Write only the file and stock-file records\n"
+		<< "                            of files that changed since the previous\n"
+		<< "                            history snapshot, and of all files every\n"
+		<< "                            N-th snapshot (default: 30). Implies\n"
+		<< "                            --ordered.\n"
+		<< " --shard=<i>/<N>            Process only every N-th history day,\n"
+		<< "                            starting with the i-th (1 <= i <= N).\n"
+		<< "                            Implies --ordered.\n"
+		<< " --merge <shard>...         Merge the outputs of all shards of a\n"
+		<< "                            history run into one ordered stream.\n"
+		<< " --resume                   Continue an interrupted history run from\n"
+		<< "                            the journal next to its output file.\n"
 		<< " -v, --verbose              Verbose output.\n"
 		<< " --use-mailmap              Use mailmap file.\n"
 		<< "\n";
@@ -56,10 +211,46 @@ static option long_options[] = {
     {"history", no_argument, 0, 'H'},
     {"pretty", no_argument, 0, 'p'},
 	{"json", no_argument, 0, 'j'},
+	{"engine", required_argument, 0, 'E'},
+	{"percentiles", no_argument, 0, 'P'},
+	{"granularity", required_argument, 0, 'G'},
+	{"max-memory", required_argument, 0, 'm'},
+	{"cache-size", required_argument, 0, 'c'},
+	{"mmap-limit", required_argument, 0, 'w'},
+	{"write-buffer", required_argument, 0, 'B'},
+	{"fsync", required_argument, 0, 'F'},
+	{"format", required_argument, 0, 'f'},
+	{"compress", required_argument, 0, 'Z'},
+	{"ordered", no_argument, 0, 'O'},
+	{"delta", optional_argument, 0, 'D'},
+	{"shard", required_argument, 0, 'S'},
+	{"merge", no_argument, 0, 'R'},
+	{"resume", no_argument, 0, 'r'},
 	{0, 0, 0, 0}
 };
 
 
+// parse a byte count with an optional K, M or G suffix, 0 on error
+static uint64_t parseSize(const char *str) {
+    char *end;
+    uint64_t size = strtoull(str, &end, 10);
+
+    switch(*end) {
+    case 'g': case 'G':
+        size <<= 10;
+        // fall through
+    case 'm': case 'M':
+        size <<= 10;
+        // fall through
+    case 'k': case 'K':
+        size <<= 10;
+        ++end;
+        break;
+    }
+
+    return *end ? 0 : size;
+}
+
 static bool isDirectory(const string& path) {
     struct stat s;
     if(stat(path.c_str(), &s)) {
@@ -82,6 +273,7 @@ int parseArgs(int argc, char **argv, bool& shouldExit) {
 	int option_index = 0;
 	int rc = 0;
 	int c;
+	bool compress = false;
 
     shouldExit = false;
 
@@ -133,6 +325,135 @@ int parseArgs(int argc, char **argv, bool& shouldExit) {
 		case 'j':
 			Options.json = true;
 			break;
+		case 'P':
+			Options.percentiles = true;
+			break;
+		case 'G':
+			if(!strcmp(optarg, "commit")) {
+				Options.granularity = GRANULARITY_COMMIT;
+			} else if(!strcmp(optarg, "day")) {
+				Options.granularity = GRANULARITY_DAY;
+			} else if(!strcmp(optarg, "week")) {
+				Options.granularity = GRANULARITY_WEEK;
+			} else if(!strcmp(optarg, "month")) {
+				Options.granularity = GRANULARITY_MONTH;
+			} else if(!strcmp(optarg, "tag")) {
+				Options.granularity = GRANULARITY_TAG;
+			} else if(!strcmp(optarg, "adaptive")) {
+				Options.granularity = GRANULARITY_ADAPTIVE;
+			} else {
+				cerr << argv[0] << ": invalid granularity: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'O':
+			Options.ordered = true;
+			break;
+		case 'D':
+			Options.delta = true;
+			Options.ordered = true;
+			if(optarg) {
+				char *end;
+				Options.keyframeInterval = strtoul(optarg, &end, 10);
+				if(*end || !Options.keyframeInterval) {
+					cerr << argv[0] << ": invalid keyframe interval: " << optarg << "\n";
+					rc = 1;
+				}
+			}
+			break;
+		case 'S': {
+			unsigned long index, count;
+			char end;
+			if(sscanf(optarg, "%lu/%lu%c", &index, &count, &end) != 2 ||
+			   index < 1 || index > count) {
+				cerr << argv[0] << ": invalid shard: " << optarg << "\n";
+				rc = 1;
+			} else {
+				Options.shardIndex = index - 1;
+				Options.shardCount = count;
+				Options.ordered = true;
+			}
+			break;
+		}
+		case 'R':
+			Options.merge = true;
+			break;
+		case 'r':
+			Options.resume = true;
+			break;
+		case 'm':
+			Options.maxMemory = parseSize(optarg);
+			if(!Options.maxMemory) {
+				cerr << argv[0] << ": invalid memory size: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'c':
+			Options.cacheSize = parseSize(optarg);
+			if(!Options.cacheSize) {
+				cerr << argv[0] << ": invalid cache size: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'w':
+			Options.mmapLimit = parseSize(optarg);
+			if(!Options.mmapLimit) {
+				cerr << argv[0] << ": invalid mmap limit: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'B':
+			Options.writeBuffer = parseSize(optarg);
+			if(!Options.writeBuffer) {
+				cerr << argv[0] << ": invalid write buffer size: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'F':
+			if(!strcmp(optarg, "never")) {
+				Options.fsync = FSYNC_NEVER;
+			} else if(!strcmp(optarg, "write")) {
+				Options.fsync = FSYNC_WRITE;
+			} else if(!strcmp(optarg, "close")) {
+				Options.fsync = FSYNC_CLOSE;
+			} else {
+				cerr << argv[0] << ": unknown fsync policy: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'f':
+			if(!strcmp(optarg, "json")) {
+				Options.format = FORMAT_JSON;
+			} else if(!strcmp(optarg, "columnar")) {
+				Options.format = FORMAT_COLUMNAR;
+			} else {
+				cerr << argv[0] << ": unknown output format: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'Z':
+			compress = true;
+			if(!strcmp(optarg, "none")) {
+				Options.compression = COMPRESS_NONE;
+			} else if(!strcmp(optarg, "gzip")) {
+				Options.compression = COMPRESS_GZIP;
+			} else if(!strcmp(optarg, "zstd")) {
+				Options.compression = COMPRESS_ZSTD;
+			} else {
+				cerr << argv[0] << ": unknown compression: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
+		case 'E':
+			if(!strcmp(optarg, "blame")) {
+				Options.engine = ENGINE_BLAME;
+			} else if(!strcmp(optarg, "provenance")) {
+				Options.engine = ENGINE_PROVENANCE;
+			} else {
+				cerr << argv[0] << ": invalid engine: " << optarg << "\n";
+				rc = 1;
+			}
+			break;
 		case '?':
 			rc = 1;
 			break;
@@ -143,11 +464,53 @@ int parseArgs(int argc, char **argv, bool& shouldExit) {
 		}
 	}
 
-	if(!rc && !shouldExit && optind < argc) {
+	if(!rc && !shouldExit && Options.merge) {
+		Options.mergeInputs.assign(argv + optind, argv + argc);
+	} else if(!rc && !shouldExit && optind < argc) {
 		Options.refName = argv[optind];
 		//cout << "ref: " << Options.refName << "\n";
 	}
 
+	if(!rc && Options.resume && (Options.destination.empty() || !Options.history)) {
+		cerr << argv[0] << ": --resume requires --history and an output file\n";
+		return 1;
+	}
+
+	if(!rc && !compress) {
+		Options.compression = FrameCompressor::fromPath(Options.destination);
+	}
+
+	if(!rc && Options.compression != COMPRESS_NONE) {
+		if(Options.destination.empty() || !Options.history || Options.merge) {
+			cerr << argv[0] << ": compressed output requires --history and an output file\n";
+			return 1;
+		} else if(!FrameCompressor::isAvailable(Options.compression)) {
+			cerr << argv[0] << ": built without zstd support\n";
+			return 1;
+		}
+	}
+
+	if(!rc && Options.format == FORMAT_COLUMNAR) {
+		if(Options.destination.empty() || !Options.history || Options.merge) {
+			cerr << argv[0] << ": columnar output requires --history and an output file\n";
+			return 1;
+		} else if(Options.compression != COMPRESS_NONE) {
+			cerr << argv[0] << ": columnar output can't be compressed\n";
+			return 1;
+		}
+	}
+
+	if(!rc && Options.delta) {
+		if(!Options.history || Options.merge || Options.format != FORMAT_JSON) {
+			cerr << argv[0] << ": --delta requires --history and JSON output\n";
+			return 1;
+		} else if(Options.shardCount > 1) {
+			// every snapshot is compared to the one before it
+			cerr << argv[0] << ": --delta can't be combined with --shard\n";
+			return 1;
+		}
+	}
+
 	if(!Options.destination.empty() && !isFileOrNotExist(Options.destination)) {
 		cerr << argv[0] << ": output path must be a regular file\n";
 		return 1;
@@ -157,7 +520,8 @@ int parseArgs(int argc, char **argv, bool& shouldExit) {
 		ofstream *output = new ofstream();
 
 		Options.output = nullptr;
-		output->open(Options.destination.c_str());
+		// a resumed run truncates the output to its journal and appends
+		output->open(Options.destination.c_str(), Options.resume ? ios::app : ios::out);
 
 		if(!output->good()) {
 			int err = errno;
@@ -206,6 +570,83 @@ string resolveRepoPath(const string& path) {
     return resolved;
 }
 
+// total size of the pack files under gitDir
+static uint64_t getPackSize(const string& gitDir) {
+    string path = gitDir + "/objects/pack";
+    DIR *dir = opendir(path.c_str());
+    dirent *entry;
+    uint64_t size = 0;
+
+    if(!dir) {
+        return 0;
+    }
+
+    while((entry = readdir(dir))) {
+        string name = entry->d_name;
+        struct stat s;
+
+        if(name.size() > 5 && name.compare(name.size() - 5, 5, ".pack") == 0 &&
+           !stat((path + "/" + name).c_str(), &s)) {
+            size += s.st_size;
+        }
+    }
+
+    closedir(dir);
+    return size;
+}
+
+//
+// Size libgit2's object cache and pack mmap limit. Both are process wide, so
+// they cover the handles of all workers together. Unless given, the cache is
+// made large enough for the packed objects, between libgit2's default and a
+// quarter of the available memory (or of --max-memory), and the mmap limit is
+// raised so that every pack fits.
+//
+static void configureObjectCache(git_repository *repo) {
+    const uint64_t DEFAULT_CACHE_SIZE = 256 << 20;
+    uint64_t packSize = getPackSize(git_repository_commondir(repo));
+    uint64_t cacheSize = Options.cacheSize;
+    uint64_t mmapLimit = Options.mmapLimit;
+
+    if(!cacheSize) {
+        uint64_t memory = Options.maxMemory ? Options.maxMemory : getAvailableMemory();
+
+        cacheSize = max(packSize, DEFAULT_CACHE_SIZE);
+        if(memory) {
+            cacheSize = min(cacheSize, memory / 4);
+        }
+    }
+
+    if(!mmapLimit) {
+        size_t current = 0;
+
+        git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &current);
+        mmapLimit = max((uint64_t)current, packSize + packSize / 4);
+    }
+
+    git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)cacheSize);
+    git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)mmapLimit);
+
+    logger.debug() << "object cache: " << (cacheSize >> 20) << " MB, mmap limit: "
+        << (mmapLimit >> 20) << " MB, packs: " << (packSize >> 20) << " MB" << endlog;
+}
+
+//
+// A history worker's own repository handle, so that workers don't contend on
+// one object cache and set of pack windows. Falls back to nullptr, the
+// timeline's repository, if it can't be opened.
+//
+static git_repository* openWorkerRepository() {
+    git_repository *repo;
+
+    if(git_repository_open(&repo, gitDirectory.c_str())) {
+        logger.error() << "failed to open " << gitDirectory << " for a worker" << endlog;
+        return nullptr;
+    }
+
+    return repo;
+}
+
 void signalHandler(int sig) {
     running.store(false);
     if(progress) {
@@ -217,68 +658,582 @@ void signalHandler(int sig) {
 
 
 
-void historyWorker(CommitTimeline *timeline, JsonReport& report) {
+static bool isJournaled(const CommitDay *day) {
+    return journal && journal->isDone(day->sequence());
+}
+
+//
+// Write a day's rendered records, through the reorder buffer when output is
+// ordered. Days that failed still submit their records, just the day record,
+// so that the ones after them aren't held back and every shard has a day
+// record for each of its days. Days abandoned on interrupt aren't written
+// at all, so the journal doesn't count them as done.
+//
+static void writeDay(JsonReport& report, OrderedWriter *ordered, const CommitDay *day,
+                     string& records, TaskPool *pool = nullptr) {
+    if(records.empty() && !running.load()) {
+        return;
+    }
+
+    if(ordered && pool) {
+        size_t sequence = day->sequence() / Options.shardCount;
+
+        // a pool thread must not block while the days before are unfinished
+        pool->helpUntil([ordered, sequence]() {
+            return ordered->canSubmit(sequence);
+        });
+    }
+
+    if(ordered) {
+        ordered->submit(day->sequence() / Options.shardCount, day, records);
+    } else {
+        report.write(records, day);
+    }
+
+    // nothing more reaches the output, so don't start any more days
+    if(output && output->failed()) {
+        running.store(false);
+    }
+}
+
+//
+// State shared by the tasks of a blame history run.
+//
+struct HistoryRun {
+    CommitTimeline *timeline;
+    JsonReport& report;
+    BlameCache& cache;
+    MemoryGate& gate;
+    OrderedWriter *ordered;
+    TaskPool& pool;
+    // a repository handle per pool thread
+    vector<git_repository*> repos;
+
+    HistoryRun(CommitTimeline *timeline, JsonReport& report, BlameCache& cache,
+               MemoryGate& gate, OrderedWriter *ordered, TaskPool& pool)
+        : timeline(timeline), report(report), cache(cache), gate(gate), ordered(ordered),
+        pool(pool) {
+    }
+};
+
+static void finishHistoryDay(HistoryRun *run, CommitDay *day, git_tree *tree,
+                             TreeMetrics *metrics);
+
+//
+// Start the next day of the timeline. Its files become tasks in the pool and
+// the rest of the day runs as their continuation, which then starts the
+// following day. runHistory starts one such chain per thread, so there are
+// at most that many days in flight, while threads that run out of days
+// steal the files of the remaining ones.
+//
+static void historyDay(HistoryRun *run) {
     CommitDay *day;
     git_tree *tree;
-    TreeMetrics *metrics;
     git_commit *last;
 
-    while(running.load()) {
-        day = timeline->pop();
-        if(!day) {
-            break;
+    while(running.load() && (day = run->timeline->pop())) {
+        string records;
+
+        run->gate.enter();
+
+        if(!day->load(run->repos[TaskPool::currentWorker()])) {
+            logger.error() << "failed to load commits for " << day->date() << endlog;
+            run->report.render(*day, records);
+            run->timeline->release(day);
+            run->gate.leave();
+            writeDay(run->report, run->ordered, day, records, &run->pool);
+            continue;
         }
 
         last = day->commits().back();
         git_commit_tree(&tree, last);
 
-        //logger.debug() << "processing day " << day->date() << " ("
-        //    << day->commits().size() << " commits)" << endlog;
+        TreeMetrics::analyze(Options.repoPath, tree, last, &run->cache, day->sequence(),
+                             run->pool, [run, day, tree](TreeMetrics *metrics) {
+            finishHistoryDay(run, day, tree, metrics);
+        });
+        return;
+    }
+}
+
+static void finishHistoryDay(HistoryRun *run, CommitDay *day, git_tree *tree,
+                             TreeMetrics *metrics) {
+    // Buffers reused by the days rendered on this thread. A pool thread runs
+    // other tasks while writeDay() waits, and a day finished by one of them
+    // takes a buffer of its own.
+    static thread_local vector<string> buffers;
+    string records;
+
+    if(!buffers.empty()) {
+        records.swap(buffers.back());
+        buffers.pop_back();
+    }
+
+    metrics->timestamp(day->timestamp());
+
+    if(progress && running.load()) {
+        progress->tick();
+    }
+
+    run->report.render(*day, records);
+    run->report.render(*metrics, records);
+
+    delete metrics;
+    run->timeline->release(day);
+    git_tree_free(tree);
+
+    // leave before a possibly waiting submit, the day's memory is freed
+    run->gate.leave();
+
+    writeDay(run->report, run->ordered, day, records, &run->pool);
+
+    // keep the buffer for the next day, whatever the writer left of it
+    records.clear();
+    buffers.push_back(string());
+    buffers.back().swap(records);
+
+    historyDay(run);
+}
+
+struct ProvenanceDay {
+    CommitDay *day;
+    ProvenanceSnapshot snapshot;
+};
 
-        metrics = new TreeMetrics(Options.repoPath, tree, last);
+//
+// Days handed from the provenance walk to the report workers. The queue is
+// bounded so the walk doesn't run ahead of the workers with too many
+// snapshots in memory.
+//
+struct ProvenanceDayQueue {
+    deque<ProvenanceDay*> days;
+    size_t capacity;
+    bool closed;
+    mutex queueMutex;
+    condition_variable notEmpty;
+    condition_variable notFull;
+
+    ProvenanceDayQueue(size_t capacity) : capacity(capacity), closed(false) {
+    }
 
-        if(progress && running.load()) {
-            progress->tick();
+    void push(ProvenanceDay *day) {
+        unique_lock<mutex> lock(queueMutex);
+        while(days.size() >= capacity) {
+            notFull.wait(lock);
         }
 
-        //writeOutput(Options.destination, day, metrics);
-        report.report(*day);
-		report.report(*metrics);
+        days.push_back(day);
+        notEmpty.notify_one();
+    }
 
-        delete metrics;
-        timeline->release(day);
-        git_tree_free(tree);
+    ProvenanceDay* pop() {
+        unique_lock<mutex> lock(queueMutex);
+        while(days.empty() && !closed) {
+            notEmpty.wait(lock);
+        }
+
+        ProvenanceDay *day = nullptr;
+        if(!days.empty()) {
+            day = days.front();
+            days.pop_front();
+            notFull.notify_one();
+        }
+
+        return day;
+    }
+
+    void close() {
+        unique_lock<mutex> lock(queueMutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+void provenanceHistoryWorker(ProvenanceDayQueue *queue, JsonReport& report,
+                             OrderedWriter *ordered, MemoryGate *gate) {
+    ProvenanceDay *day;
+    git_tree *tree;
+    TreeMetrics *metrics;
+    git_commit *last;
+    git_repository *repo = openWorkerRepository();
+
+    while((day = queue->pop())) {
+        string records;
+
+        if(running.load() && day->day->load(repo)) {
+            last = day->day->commits().back();
+            git_commit_tree(&tree, last);
+
+            metrics = new TreeMetrics(Options.repoPath, tree, day->snapshot, last);
+            metrics->timestamp(day->day->timestamp());
+
+            if(progress && running.load()) {
+                progress->tick();
+            }
+
+            report.render(*day->day, records);
+            report.render(*metrics, records);
+
+            delete metrics;
+            git_tree_free(tree);
+            day->day->release();
+        } else if(running.load()) {
+            logger.error() << "failed to load commits for " << day->day->date() << endlog;
+            report.render(*day->day, records);
+        }
+
+        writeDay(report, ordered, day->day, records);
+        delete day;
+        gate->leave();
+    }
+
+    if(repo) {
+        git_repository_free(repo);
+    }
+}
+
+//
+// History without blame: walk history once, oldest commit first, keeping the
+// line origins of every file up to date and emitting each day's records from
+// the snapshot at the day's last commit.
+//
+int runProvenanceHistory(CommitTimeline *timeline, git_commit *commit, JsonReport& report) {
+    unordered_map<git_oid, CommitDay*, OidHash, OidEqual> dayCommits;
+    ProvenanceDayQueue queue(Options.threads * 2);
+    // the walk waits for the queued days while over the memory budget
+    MemoryGate gate(nullptr, nullptr);
+    vector<thread*> threads;
+    LineProvenance provenance(commit);
+    OrderedWriter *ordered = nullptr;
+
+    for(CommitDay *day : *timeline) {
+        dayCommits[*day->lastCommitId()] = day;
+    }
+
+    if(Options.ordered) {
+        // the walk is topological rather than by time, so the reorder buffer
+        // can't be bounded without risking the walk and workers waiting on
+        // each other
+        ordered = new OrderedWriter(report, timeline->scheduledDays(), 0,
+                                    journal ? journal->doneCount() : 0);
+    }
+
+    if(journal) {
+        timeline->skip(isJournaled);
+    }
+
+    progress->setTotal(timeline->scheduledDays());
+    progress->draw();
+    for(int i = 0; i < Options.threads; ++i) {
+        threads.push_back(new thread(provenanceHistoryWorker, &queue, std::ref(report), ordered,
+                                     &gate));
+    }
+
+    provenance.walk([&](git_commit *current, const ProvenanceSnapshot& snapshot) {
+        auto it = dayCommits.find(*git_commit_id(current));
+        if(it != dayCommits.end() && !isJournaled(it->second) &&
+           it->second->sequence() % Options.shardCount == Options.shardIndex) {
+            gate.enter();
+
+            ProvenanceDay *day = new ProvenanceDay();
+            day->day = it->second;
+            // file origins are shared, so this only copies the file table
+            day->snapshot = snapshot;
+            queue.push(day);
+        }
+
+        return running.load();
+    });
+
+    queue.close();
+    for(thread *t : threads) {
+        t->join();
+    }
+
+    if(ordered) {
+        if(!running.load()) {
+            ordered->cancel();
+        }
+        delete ordered;
+    }
+
+    if(Options.verbose && Options.maxMemory) {
+        logger.info() << "memory budget crossed " << gate.crossingCount()
+            << " times, exceeded before " << gate.waitCount() << " days" << endlog;
+    }
+
+    return 0;
+}
+
+//
+// Identifies a history run in its journal: the head commit and every option
+// that changes which records are written.
+//
+static string journalRun(git_commit *commit) {
+    ostringstream ss;
+    char head[GIT_OID_HEXSZ + 1];
+
+    git_oid_tostr(head, sizeof(head), git_commit_id(commit));
+    ss << "head " << head
+        << " granularity " << Options.granularity
+        << " shard " << (Options.shardIndex + 1) << "/" << Options.shardCount
+        << " ordered " << Options.ordered
+        << " engine " << Options.engine
+        << " mailmap " << Options.useMailMapFile
+        << " percentiles " << Options.percentiles
+        << " compression " << Options.compression
+        << " format " << Options.format
+        << " delta " << (Options.delta ? Options.keyframeInterval : 0)
+        << " now " << Options.nowTimestamp;
+
+    for(const string& pattern : Options.excludePatterns) {
+        ss << " exclude " << pattern;
+    }
+
+    return ss.str();
+}
+
+//
+// Open the journal and the writer stage of a run writing to a file. On
+// --resume the output is cut back to the last journaled day. Compressed
+// output is compressed on pool.
+//
+static bool openOutput(JsonReport& report, git_commit *commit, TaskPool *pool) {
+    FrameCompressor *compressor = nullptr;
+    int fd;
+
+    if(Options.destination.empty()) {
+        return true;
+    }
+
+    journal = new Journal(Options.destination, journalRun(commit));
+    if(Options.resume && !journal->load()) {
+        cerr << Options.destination << ".journal is from a different run\n";
+        return false;
+    }
+
+    if(!journal->open()) {
+        return false;
+    }
+
+    // the journal has cut the output to the size the writer appends to
+    fd = open(Options.destination.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) {
+        cerr << "failed to open " << Options.destination << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    if(Options.compression != COMPRESS_NONE) {
+        compressor = new FrameCompressor(Options.compression);
+
+        // the seek table of the frames written so far goes at the end
+        if(!compressor->scan(fd, journal->outputSize())) {
+            cerr << Options.destination << " does not end with a complete frame\n";
+            delete compressor;
+            close(fd);
+            return false;
+        }
+    }
+
+    if(Options.format == FORMAT_COLUMNAR) {
+        string error;
+
+        // ids already in the output keep their strings
+        columnar = new ColumnarWriter();
+        if(journal->outputSize() && !columnar->load(Options.destination, error)) {
+            cerr << error << "\n";
+            close(fd);
+            return false;
+        }
+    }
+
+    output = new OutputWriter(fd, Options.writeBuffer, Options.fsync, journal,
+                              journal->outputSize(), compressor, pool);
+    report.output(output);
+
+    if(columnar) {
+        columnar->output(output);
+        report.columnar(columnar);
+
+        if(!journal->outputSize()) {
+            string header;
+            columnar->header(header);
+            report.write(header);
+        }
+    }
+
+    if(journal->doneCount()) {
+        cout << "Resuming:           " << journal->doneCount() << " snapshots already written\n";
+    }
+
+    return true;
+}
+
+static bool closeOutput() {
+    bool ok;
+
+    if(!output) {
+        return true;
     }
+
+    ok = output->close();
+    if(!ok) {
+        cerr << "failed to write " << Options.destination << "\n";
+    }
+
+    journal->sync();
+
+    cout << "Output written:     " << (output->bytesWritten() >> 20) << " MB";
+    if(Options.compression != COMPRESS_NONE) {
+        cout << " from " << (output->recordBytes() >> 20) << " MB of records";
+    }
+    if(output->writeMicroseconds() > 0) {
+        cout << " at " << fixed << setprecision(1)
+            << ((double)output->bytesWritten() / output->writeMicroseconds()) << " MB/s";
+    }
+    cout << ", " << output->stalls() << " queue stalls\n";
+
+    return ok;
+}
+
+//
+// First record of a shard's output; --merge uses it to check that all shards
+// of the same run are present.
+//
+static void reportShard(JsonReport& report, const CommitTimeline *timeline, git_commit *commit) {
+    Json::Value json(Json::objectValue);
+    char head[GIT_OID_HEXSZ + 1];
+
+    git_oid_tostr(head, sizeof(head), git_commit_id(commit));
+
+    json["_type"] = "shard";
+    json["Shard"] = (Json::UInt)(Options.shardIndex + 1);
+    json["ShardCount"] = (Json::UInt)Options.shardCount;
+    json["Days"] = timeline->days();
+    json["Head"] = head;
+    json["Granularity"] = (int)Options.granularity;
+
+    report.report(json);
 }
 
 int runHistory(git_commit *commit) {
     CommitTimeline *timeline;
-    vector<thread*> threads;
-    bool threadsActive = true;
     JsonReport report;
+    // keep a few versions per thread so that days being processed
+    // concurrently, and the days of a scheduling window, can share blame
+    // results
+    size_t cacheVersions = Options.threads * 4;
+    OrderedWriter *ordered = nullptr;
+    chrono::steady_clock::time_point start;
 
     progress = new GitStockProgress(80);
 
-    threads.reserve(Options.threads);
-
     cout << "Building timeline... " << flush;
     timeline = new CommitTimeline(commit);
     cout << "done\n"
-        << "Days with activity: " << timeline->days() << "\n"
+        << "Snapshots:          " << timeline->days() << "\n"
         << "Total Commits:      " << timeline->commits() << "\n";
 
-    progress->setTotal(timeline->days());
+    // also compresses the output, so it's started before the output is opened
+    TaskPool pool(Options.threads);
+
+    if(!openOutput(report, commit, &pool)) {
+        return 1;
+    }
+
+    // The shard record is part of the output up to the first journaled day.
+    // Columnar output has the shard in its file header.
+    if(Options.shardCount > 1 && Options.format == FORMAT_JSON &&
+       (!journal || !journal->outputSize())) {
+        reportShard(report, timeline, commit);
+    }
+
+    if(Options.engine == ENGINE_PROVENANCE) {
+        timeline->shard(Options.shardIndex, Options.shardCount);
+        int rc = runProvenanceHistory(timeline, commit, report);
+        if(!closeOutput()) {
+            rc = 1;
+        }
+        return rc;
+    }
+
+    // which files each day changed tells the blame cache which results
+    // carry over from one snapshot to the next
+    timeline->findChanges(Options.threads);
+    BlameCache cache([timeline](size_t sequence, const string& path) {
+        return timeline->unchanged(sequence, path);
+    }, cacheVersions);
+
+    if(Options.ordered) {
+        // days are handed out in the order they are written so that the
+        // reorder window only has to absorb the spread in day costs
+        timeline->scheduleOldestFirst();
+        timeline->shard(Options.shardIndex, Options.shardCount);
+        // ordered output is journaled in order, so the written days are the
+        // first ones
+        ordered = new OrderedWriter(report, timeline->scheduledDays(), Options.threads * 4,
+                                    journal ? journal->doneCount() : 0);
+    } else {
+        // Days are only reordered among as many as the cache has versions
+        // for. A wider window also spreads the days in flight apart, so
+        // fewer of them blame the same new blob at once.
+        timeline->schedule(Options.threads, cacheVersions);
+    }
+
+    if(journal) {
+        timeline->skip(isJournaled);
+    }
+
+    MemoryGate gate(&cache, &pool);
+    HistoryRun run(timeline, report, cache, gate, ordered, pool);
+
+    for(int i = 0; i < Options.threads; ++i) {
+        run.repos.push_back(openWorkerRepository());
+    }
+
+    progress->setTotal(timeline->scheduledDays());
     progress->draw();
+    start = chrono::steady_clock::now();
     for(int i = 0; i < Options.threads; ++i) {
-        thread *t = new thread(historyWorker, timeline, std::ref(report));
-        threads.push_back(t);
+        pool.submit([&run]() {
+            historyDay(&run);
+        });
     }
 
-    for(thread *t : threads) {
-        t->join();
+    pool.wait();
+
+    for(git_repository *repo : run.repos) {
+        if(repo) {
+            git_repository_free(repo);
+        }
     }
 
-    return 0;
+    if(ordered) {
+        if(!running.load()) {
+            ordered->cancel();
+        }
+        delete ordered;
+    }
+
+    bool written = closeOutput();
+
+    int64_t elapsed = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - start).count();
+    if(elapsed > 0) {
+        cout << "Thread utilization: " << fixed << setprecision(1)
+            << (100.0 * pool.busyMicroseconds() / ((double)elapsed * Options.threads)) << "%\n";
+    }
+
+    if(Options.verbose) {
+        logger.info() << "blame cache: " << cache.hits() << " hits, "
+            << cache.misses() << " misses" << endlog;
+        if(Options.maxMemory) {
+            logger.info() << "memory budget crossed " << gate.crossingCount()
+                << " times, exceeded before " << gate.waitCount() << " days" << endlog;
+        }
+    }
+
+    return written ? 0 : 1;
 }
 
 int runSingle(git_commit *commit) {
@@ -286,7 +1241,34 @@ int runSingle(git_commit *commit) {
     TreeMetrics *metrics;
 
     git_commit_tree(&tree, commit);
-    metrics = new TreeMetrics(Options.repoPath, tree, commit);
+
+    if(Options.engine == ENGINE_PROVENANCE) {
+        LineProvenance provenance(commit);
+        const git_oid *head = git_commit_id(commit);
+
+        metrics = nullptr;
+        provenance.walk([&](git_commit *current, const ProvenanceSnapshot& snapshot) {
+            if(git_oid_equal(git_commit_id(current), head)) {
+                metrics = new TreeMetrics(Options.repoPath, tree, snapshot, commit);
+                return false;
+            }
+
+            return true;
+        });
+    } else {
+        TaskPool pool(Options.threads);
+        metrics = new TreeMetrics(Options.repoPath, tree, commit, &pool);
+    }
+
+    // the provenance walk stops short of the commit on error or interrupt
+    if(!metrics) {
+        char head[GIT_OID_HEXSZ + 1];
+
+        git_oid_tostr(head, sizeof(head), git_commit_id(commit));
+        logger.error() << "failed to attribute the lines of " << head << endlog;
+        git_tree_free(tree);
+        return 1;
+    }
 
 	if(Options.json) {
 		JsonReport report;
@@ -296,7 +1278,7 @@ int runSingle(git_commit *commit) {
 		report.report(*metrics);
 	}
 
-    //delete metrics;
+    delete metrics;
     git_tree_free(tree);
 
     return 0;
@@ -315,6 +1297,12 @@ int main(int argc, char **argv) {
 		return rc;
 	}
 
+    if(Options.merge) {
+        rc = mergeShards(Options.mergeInputs, *Options.output);
+        Options.output->flush();
+        return rc;
+    }
+
 	signal(SIGINT, signalHandler);
 
 	git_libgit2_init();
@@ -325,6 +1313,8 @@ int main(int argc, char **argv) {
     }
 
     Options.repoPath = resolveRepoPath(git_repository_path(repo));
+    gitDirectory = git_repository_path(repo);
+    configureObjectCache(repo);
 
 	commit = resolveRef(repo, Options.refName);
 
@@ -334,6 +1324,7 @@ int main(int argc, char **argv) {
 
     if(Options.history) {
         rc = runHistory(commit);
+        cout << "Peak memory:        " << (getPeakResidentMemory() >> 20) << " MB\n";
     } else {
         rc = runSingle(commit);
     }
@@ -0,0 +1,272 @@
+
+#include "ColumnarReader.hh"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+
+using namespace std;
+using namespace gitstock;
+using namespace gitstock::columnar;
+
+static void printUsage(const string& app) {
+	cerr << "usage: " << app << " [options] <file> <table> [<column>...]\n"
+		<< "\n"
+		<< "Print columns of a table from a columnar history file written with\n"
+		<< "git-stock --history --format=columnar, one tab separated line per row\n"
+		<< "in timestamp order. The Timestamp column comes first; without other\n"
+		<< "columns all of the table's columns are printed.\n"
+		<< "\n"
+		<< " --author=<email>           Only rows of this author.\n"
+		<< " --path=<path>              Only rows of this file.\n"
+		<< " -h, --help                 Show this help.\n"
+		<< "\n"
+		<< "Tables: commit-day, commit, tree, file, stock-file and stock.\n"
+		<< "\n";
+}
+
+static option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"author", required_argument, 0, 'a'},
+	{"path", required_argument, 0, 'p'},
+	{0, 0, 0, 0}
+};
+
+static bool parseTable(const char *name, Table& table) {
+    for(int i = 0; i < TABLE_COUNT; ++i) {
+        if(!strcmp(name, tableName((Table)i))) {
+            table = (Table)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool parseColumn(const char *name, Column& column) {
+    for(int i = 0; i < COLUMN_COUNT; ++i) {
+        if(!strcmp(name, columnName((Column)i))) {
+            column = (Column)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static ChunkType tableChunk(Table table) {
+    return table == TABLE_COMMIT_DAY || table == TABLE_COMMIT ? CHUNK_DAY : CHUNK_SNAPSHOT;
+}
+
+// messages are printed on one line
+static void printText(const string& text) {
+    for(char c : text) {
+        switch(c) {
+        case '\\':
+            cout << "\\\\";
+            break;
+        case '\t':
+            cout << "\\t";
+            break;
+        case '\n':
+            cout << "\\n";
+            break;
+        case '\r':
+            cout << "\\r";
+            break;
+        default:
+            cout << c;
+        }
+    }
+}
+
+static void printValue(const ColumnarReader& reader, const ColumnarColumn& column, size_t row) {
+    char digits[32];
+
+    if(row >= column.rows()) {
+        return;
+    }
+
+    switch(column.encoding()) {
+    case ENCODING_STRING_ID:
+        printText(reader.lookup(column.id(row)));
+        break;
+    case ENCODING_TEXT:
+        printText(column.text(row));
+        break;
+    case ENCODING_DOUBLE:
+        // as precise as the JSON output
+        snprintf(digits, sizeof(digits), "%.17g", column.real(row));
+        cout << digits;
+        break;
+    case ENCODING_UINT64:
+        cout << (uint64_t)column.integer(row);
+        break;
+    default:
+        cout << column.integer(row);
+        break;
+    }
+}
+
+//
+// The file column of a stock-file row refers to a row of the file table; a
+// stock-file's path is looked up through it.
+//
+static ColumnarColumn columnOf(const ColumnarPartition& partition, Table table, Column column) {
+    if(table == TABLE_STOCK_FILE && column == COLUMN_FILE_PATH) {
+        return partition.column(TABLE_STOCK_FILE, COLUMN_FILE);
+    }
+
+    return partition.column(table, column);
+}
+
+static uint32_t pathId(const ColumnarPartition& partition, Table table, size_t row) {
+    ColumnarColumn paths = partition.column(TABLE_FILE, COLUMN_FILE_PATH);
+
+    if(table == TABLE_STOCK_FILE) {
+        ColumnarColumn files = partition.column(TABLE_STOCK_FILE, COLUMN_FILE);
+        row = row < files.rows() ? files.id(row) : paths.rows();
+    }
+
+    return row < paths.rows() ? paths.id(row) : NO_STRING;
+}
+
+int main(int argc, char **argv) {
+	int option_index = 0;
+	int c;
+	const char *author = nullptr;
+	const char *path = nullptr;
+	ColumnarReader reader;
+	Table table;
+	vector<Column> columns;
+	uint32_t authorId = NO_STRING;
+	uint32_t pathFilter = NO_STRING;
+
+	while((c = getopt_long(argc, argv, "h", long_options, &option_index)) != -1) {
+		switch(c) {
+		case 'a':
+			author = optarg;
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		case 'h':
+			printUsage(argv[0]);
+			return 0;
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(argc - optind < 2) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	if(!parseTable(argv[optind + 1], table)) {
+		cerr << argv[0] << ": unknown table: " << argv[optind + 1] << "\n";
+		return 1;
+	}
+
+	for(int i = optind + 2; i < argc; ++i) {
+		Column column;
+
+		if(!parseColumn(argv[i], column)) {
+			cerr << argv[0] << ": unknown column: " << argv[i] << "\n";
+			return 1;
+		} else if(column != COLUMN_TIMESTAMP) {
+			columns.push_back(column);
+		}
+	}
+
+	if(author && table != TABLE_COMMIT && table != TABLE_STOCK_FILE && table != TABLE_STOCK) {
+		cerr << argv[0] << ": --author needs the commit, stock-file or stock table\n";
+		return 1;
+	} else if(path && table != TABLE_FILE && table != TABLE_STOCK_FILE) {
+		cerr << argv[0] << ": --path needs the file or stock-file table\n";
+		return 1;
+	}
+
+	if(!reader.open(argv[optind])) {
+		cerr << argv[0] << ": " << reader.error() << "\n";
+		return 1;
+	}
+
+	if(author) {
+		authorId = reader.find(author);
+	}
+	if(path) {
+		pathFilter = reader.find(path);
+	}
+	// a string that isn't in the dictionary matches nothing
+	bool none = (author && authorId == NO_STRING) || (path && pathFilter == NO_STRING);
+
+	ios::sync_with_stdio(false);
+
+	// without columns, all the table has, in the order of the JSON keys
+	for(size_t i = 0; columns.empty() && i < reader.partitions(); ++i) {
+		const ColumnarPartition& partition = reader.partition(i);
+
+		if(partition.type() != tableChunk(table)) {
+			continue;
+		}
+
+		for(int column = COLUMN_TIMESTAMP + 1; column < COLUMN_COUNT; ++column) {
+			if(column != COLUMN_FILE && columnOf(partition, table, (Column)column).exists()) {
+				columns.push_back((Column)column);
+			}
+		}
+		break;
+	}
+
+	cout << columnName(COLUMN_TIMESTAMP);
+	for(Column column : columns) {
+		cout << '\t' << columnName(column);
+	}
+	cout << '\n';
+
+	for(size_t i = 0; i < reader.partitions(); ++i) {
+		const ColumnarPartition& partition = reader.partition(i);
+		vector<ColumnarColumn> values;
+		ColumnarColumn timestamps = partition.column(table, COLUMN_TIMESTAMP);
+		ColumnarColumn authors = partition.column(table, COLUMN_AUTHOR_EMAIL);
+
+		if(none || partition.type() != tableChunk(table)) {
+			continue;
+		}
+
+		for(Column column : columns) {
+			values.push_back(columnOf(partition, table, column));
+		}
+
+		for(size_t row = 0; row < partition.rows(table); ++row) {
+			if(author && (row >= authors.rows() || authors.id(row) != authorId)) {
+				continue;
+			} else if(path && pathId(partition, table, row) != pathFilter) {
+				continue;
+			}
+
+			// only commits have their own timestamps
+			if(timestamps.exists()) {
+				cout << timestamps.integer(row);
+			} else {
+				cout << partition.timestamp();
+			}
+
+			for(size_t j = 0; j < columns.size(); ++j) {
+				cout << '\t';
+				if(table == TABLE_STOCK_FILE && columns[j] == COLUMN_FILE_PATH) {
+					printText(reader.lookup(pathId(partition, table, row)));
+				} else {
+					printValue(reader, values[j], row);
+				}
+			}
+			cout << '\n';
+		}
+	}
+
+	return 0;
+}
@@ -3,6 +3,10 @@
 #include <git2/commit.h>
 #include <sstream>
 #include <iomanip>
+#include <time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 
 using namespace std;
@@ -64,9 +68,79 @@ string formatPercent(double value) {
 }
 
 int64_t getDayTimestamp(const git_commit *commit) {
-	int64_t timestamp = git_commit_time(commit);
+	return getDayTimestamp((int64_t)git_commit_time(commit));
+}
+
+int64_t getDayTimestamp(int64_t timestamp) {
 	return timestamp - (timestamp % SECONDS_PER_DAY);
 }
 
+int64_t getWeekTimestamp(int64_t timestamp) {
+	// the epoch was a Thursday; weeks start on Monday
+	int64_t days = timestamp / SECONDS_PER_DAY;
+	return (days - (days + 3) % 7) * SECONDS_PER_DAY;
+}
+
+int64_t getMonthTimestamp(int64_t timestamp) {
+	time_t t = timestamp;
+	tm date;
+
+	gmtime_r(&t, &date);
+	date.tm_mday = 1;
+	date.tm_hour = 0;
+	date.tm_min = 0;
+	date.tm_sec = 0;
+
+	return timegm(&date);
+}
+
+
+uint64_t getResidentMemory() {
+	FILE *statm = fopen("/proc/self/statm", "r");
+	unsigned long size, resident = 0;
+
+	if(statm) {
+		if(fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+	}
+
+	return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+uint64_t getPeakResidentMemory() {
+	rusage usage;
+
+	if(getrusage(RUSAGE_SELF, &usage)) {
+		return 0;
+	}
+
+	// ru_maxrss is in kilobytes on Linux
+	return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+uint64_t getAvailableMemory() {
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	char line[256];
+	unsigned long long available = 0;
+
+	if(meminfo) {
+		while(fgets(line, sizeof(line), meminfo)) {
+			if(sscanf(line, "MemAvailable: %llu kB", &available) == 1) {
+				break;
+			}
+		}
+		fclose(meminfo);
+	}
+
+	if(available) {
+		return (uint64_t)available * 1024;
+	}
+
+	// kernels before 3.14 don't report MemAvailable
+	return (uint64_t)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
 
 }